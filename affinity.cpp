@@ -0,0 +1,226 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "affinity.hpp"
+#include "predictor.hpp"
+
+int OnlineCpus() {
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+std::vector<int> CpuRange(int first, int count) {
+  const std::vector<CpuInfo> &topology = CpuTopology();
+  const int n = topology.size();
+  std::vector<int> cpus;
+  for(int i = 0; i < count && i < n; i++) {
+    cpus.push_back(topology[(first + i) % n].cpu);
+  }
+  return cpus;
+}
+
+static long ReadSysValue(const std::string &path, long fallback) {
+  std::ifstream file(path);
+  long value;
+  return file >> value ? value : fallback;
+}
+
+#ifdef __linux__
+
+// CPUs the process (its main thread, not a possibly pinned caller) may use
+static std::vector<int> ProcessCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if(sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
+    for(int i = 0; i < CPU_SETSIZE; i++) {
+      if(CPU_ISSET(i, &set)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+  return cpus;
+}
+
+static std::vector<int> CurrentAffinity() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if(sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for(int i = 0; i < CPU_SETSIZE; i++) {
+    if(CPU_ISSET(i, &set)) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+bool PinCurrentThread(const std::vector<int> &cpus) {
+  if(cpus.empty()) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+static std::vector<int> ProcessCpus() { return std::vector<int>(); }
+
+static std::vector<int> CurrentAffinity() { return std::vector<int>(); }
+
+bool PinCurrentThread(const std::vector<int> &cpus) { return false; }
+
+#endif  // __linux__
+
+ScopedAffinity::ScopedAffinity(const std::vector<int> &cpus) {
+  if(cpus.empty()) {
+    return;
+  }
+  previous_ = CurrentAffinity();
+  pinned_ = !previous_.empty() && PinCurrentThread(cpus);
+}
+
+ScopedAffinity::~ScopedAffinity() {
+  if(pinned_) {
+    PinCurrentThread(previous_);
+  }
+}
+
+static std::vector<CpuInfo> ProbeTopology() {
+  std::vector<int> cpus = ProcessCpus();
+  if(cpus.empty()) {
+    for(int i = 0; i < OnlineCpus(); i++) {
+      cpus.push_back(i);
+    }
+  }
+  std::vector<CpuInfo> topology;
+  for(int cpu : cpus) {
+    const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    CpuInfo info;
+    info.cpu = cpu;
+    info.package = ReadSysValue(base + "/topology/physical_package_id", 0);
+    info.core = ReadSysValue(base + "/topology/core_id", cpu);
+    info.max_freq_khz = ReadSysValue(base + "/cpufreq/cpuinfo_max_freq", 0);
+    topology.push_back(info);
+  }
+
+  // rank of each CPU among the hardware threads of its core
+  std::map<std::pair<int, int>, int> seen;
+  std::vector<int> sibling(topology.size());
+  for(size_t i = 0; i < topology.size(); i++) {
+    sibling[i] = seen[std::make_pair(topology[i].package, topology[i].core)]++;
+  }
+  std::vector<size_t> order(topology.size());
+  for(size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if(sibling[a] != sibling[b]) {
+      return sibling[a] < sibling[b];
+    }
+    return topology[a].max_freq_khz > topology[b].max_freq_khz;
+  });
+  std::vector<CpuInfo> sorted;
+  for(size_t i : order) {
+    sorted.push_back(topology[i]);
+  }
+  return sorted;
+}
+
+const std::vector<CpuInfo>& CpuTopology() {
+  static const std::vector<CpuInfo> topology = ProbeTopology();
+  return topology;
+}
+
+int PhysicalCores() {
+  static const int cores = [] {
+    std::map<std::pair<int, int>, int> cores;
+    for(const CpuInfo &info : CpuTopology()) {
+      cores[std::make_pair(info.package, info.core)]++;
+    }
+    return std::max<int>(1, cores.size());
+  }();
+  return cores;
+}
+
+namespace {
+
+std::mutex lease_mutex;
+int thread_policy = PREDICTOR_THREADS_DEFAULT;
+int leased_threads = 0;
+std::map<int, int> cpu_load; // leased threads per CPU
+
+}  // namespace
+
+int ThreadPolicy() {
+  std::lock_guard<std::mutex> lock(lease_mutex);
+  return thread_policy;
+}
+
+CpuLease LeaseCpus(int requested) {
+  std::lock_guard<std::mutex> lock(lease_mutex);
+  const int cores = PhysicalCores();
+  CpuLease lease;
+  lease.threads = std::max(1, std::min(requested, cores - leased_threads));
+  leased_threads += lease.threads;
+
+  // one CPU per physical core (the first `cores` entries), least loaded
+  // first, ties going to the faster core
+  const std::vector<CpuInfo> &topology = CpuTopology();
+  std::vector<int> candidates;
+  for(int i = 0; i < cores && i < (int)topology.size(); i++) {
+    candidates.push_back(topology[i].cpu);
+  }
+  std::stable_sort(candidates.begin(), candidates.end(), [](int a, int b) {
+    return cpu_load[a] < cpu_load[b];
+  });
+  for(int i = 0; i < lease.threads && i < (int)candidates.size(); i++) {
+    lease.cpus.push_back(candidates[i]);
+    cpu_load[candidates[i]]++;
+  }
+  return lease;
+}
+
+void ReturnCpus(const CpuLease &lease) {
+  std::lock_guard<std::mutex> lock(lease_mutex);
+  leased_threads -= lease.threads;
+  for(int cpu : lease.cpus) {
+    cpu_load[cpu]--;
+  }
+}
+
+void SetThreadPolicyTflite(int policy) {
+  std::lock_guard<std::mutex> lock(lease_mutex);
+  thread_policy = policy;
+}
+
+void GetThreadStatsTflite(ThreadStats* stats) {
+  if(stats == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lease_mutex);
+  stats->policy = thread_policy;
+  stats->online_cpus = OnlineCpus();
+  stats->usable_cpus = CpuTopology().size();
+  stats->physical_cores = PhysicalCores();
+  stats->leased_threads = leased_threads;
+  stats->oversubscribed_threads = std::max(0, leased_threads - PhysicalCores());
+  stats->max_freq_khz = CpuTopology().empty() ? 0 : CpuTopology()[0].max_freq_khz;
+}
@@ -0,0 +1,209 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+using std::chrono::steady_clock;
+
+/*
+  Batcher coalesces single-image requests submitted from many threads into one
+  batched Invoke on a shared predictor. A request is dispatched once max_batch
+  requests are queued or the oldest queued request has waited max_wait_us.
+  The input tensor is resized to max_batch once, for the batcher's lifetime:
+  smaller batches leave the unused slots zeroed rather than reallocating the
+  tensor arena on every change of load. The predictor gets its own batch
+  size back when the batcher is deleted.
+*/
+class Batcher {
+  public:
+    Batcher(Predictor* predictor, int max_batch, int max_wait_us);
+    ~Batcher();
+    // Blocks until the request has been served; out receives pred_len floats
+    void Predict(int* inputData_quantize, float* inputData_float, bool quantize, float* out);
+    void Stats(BatcherStats* stats);
+
+  private:
+    struct Request {
+      int* inputData_quantize;
+      float* inputData_float;
+      bool quantize;
+      float* out;
+      steady_clock::time_point enqueued;
+      std::promise<void> done;
+    };
+
+    void Run();
+    void Dispatch(std::vector<Request*>& batch);
+
+    Predictor* predictor_;
+    int max_batch_;
+    int original_batch_; // restored on deletion
+    std::chrono::microseconds max_wait_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<Request*> queue_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    // stats, guarded by mutex_
+    long long batches_ = 0;
+    long long requests_ = 0;
+    double total_delay_us_ = 0;
+    double max_delay_us_ = 0;
+};
+
+Batcher::Batcher(Predictor* predictor, int max_batch, int max_wait_us)
+  : predictor_(predictor), max_batch_(max_batch), original_batch_(predictor->batch_), max_wait_(max_wait_us) {
+  if(max_batch < 1 || max_wait_us < 0) {
+    throw std::invalid_argument("invalid batcher configuration");
+  }
+  // backends that cannot be resized run every batch at their fixed size
+  if(!predictor_->SetBatch(max_batch_)) {
+    max_batch_ = predictor_->batch_;
+  }
+  worker_ = std::thread(&Batcher::Run, this);
+}
+
+Batcher::~Batcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  worker_.join();
+  predictor_->SetBatch(original_batch_);
+}
+
+void Batcher::Predict(int* inputData_quantize, float* inputData_float, bool quantize, float* out) {
+  Request request;
+  request.inputData_quantize = inputData_quantize;
+  request.inputData_float = inputData_float;
+  request.quantize = quantize;
+  request.out = out;
+  std::future<void> done = request.done.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    request.enqueued = steady_clock::now();
+    queue_.push_back(&request);
+  }
+  cond_.notify_all();
+  done.wait();
+}
+
+void Batcher::Run() {
+  std::vector<Request*> batch;
+  batch.reserve(max_batch_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for(;;) {
+    cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if(queue_.empty()) {
+      // stop_ is set and every request has been served
+      return;
+    }
+    // hold the batch open until it is full or the oldest request expires
+    const auto deadline = queue_.front()->enqueued + max_wait_;
+    cond_.wait_until(lock, deadline, [this] {
+      return stop_ || (int)queue_.size() >= max_batch_;
+    });
+
+    const auto now = steady_clock::now();
+    const int n = std::min((int)queue_.size(), max_batch_);
+    for(int i = 0; i < n; i++) {
+      Request* request = queue_.front();
+      queue_.pop_front();
+      const double delay_us = std::chrono::duration<double, std::micro>(now - request->enqueued).count();
+      total_delay_us_ += delay_us;
+      max_delay_us_ = std::max(max_delay_us_, delay_us);
+      batch.push_back(request);
+    }
+    batches_++;
+    requests_ += n;
+
+    lock.unlock();
+    Dispatch(batch);
+    batch.clear();
+    lock.lock();
+  }
+}
+
+void Batcher::Dispatch(std::vector<Request*>& batch) {
+  const int n = batch.size();
+  for(int i = 0; i < n; i++) {
+    predictor_->FillInput(i, batch[i]->inputData_quantize, batch[i]->inputData_float, batch[i]->quantize);
+  }
+  // padding: results of the unused slots are ignored, zeroing them keeps
+  // the invoke deterministic (and the result cache effective)
+  TfLiteTensor* input = predictor_->interpreter->tensor(predictor_->input_);
+  const size_t slot_bytes = input->bytes / predictor_->batch_;
+  memset(input->data.raw + n * slot_bytes, 0, (predictor_->batch_ - n) * slot_bytes);
+  predictor_->Invoke();
+  predictor_->ReadOutput();
+
+  const int pred_len = predictor_->pred_len_;
+  for(int i = 0; i < n; i++) {
+    std::copy(predictor_->result_float_ + i * pred_len,
+              predictor_->result_float_ + (i + 1) * pred_len,
+              batch[i]->out);
+    batch[i]->done.set_value();
+  }
+}
+
+void Batcher::Stats(BatcherStats* stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats->queue_depth = queue_.size();
+  stats->batches = batches_;
+  stats->requests = requests_;
+  stats->mean_batch_size = batches_ ? (double)requests_ / batches_ : 0;
+  stats->mean_queue_delay_us = requests_ ? total_delay_us_ / requests_ : 0;
+  stats->max_queue_delay_us = max_delay_us_;
+}
+
+BatcherContext NewBatcherTflite(PredictorContext pred, int max_batch, int max_wait_us) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return nullptr;
+  }
+  try {
+    const auto ctx = new Batcher(predictor, max_batch, max_wait_us);
+    return (void *) ctx;
+  } catch(const std::invalid_argument &ex) {
+    errno = EINVAL;
+    return nullptr;
+  }
+}
+
+void PredictBatcherTflite(BatcherContext b, int* inputData_quantize, float* inputData_float, bool quantize, float* out) {
+  auto batcher = (Batcher *)b;
+  if (batcher == nullptr) {
+    return;
+  }
+  batcher->Predict(inputData_quantize, inputData_float, quantize, out);
+}
+
+void GetBatcherStatsTflite(BatcherContext b, BatcherStats* stats) {
+  auto batcher = (Batcher *)b;
+  if (batcher == nullptr || stats == nullptr) {
+    return;
+  }
+  batcher->Stats(stats);
+}
+
+void DeleteBatcherTflite(BatcherContext b) {
+  auto batcher = (Batcher *)b;
+  if (batcher == nullptr) {
+    return;
+  }
+  delete batcher;
+}
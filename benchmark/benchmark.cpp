@@ -0,0 +1,764 @@
+/*
+  Native benchmark harness for the predictor. Loads a .tflite model through
+  the same C API the Go binding uses (NewTflite / PredictImageTflite) and, for
+  every requested mode and batch size, prints as JSON on stdout:
+
+    - cold-start load time, first invoke latency, steady-state latency
+      percentiles and throughput
+    - the resident set growth of the run and the peak RSS of the process
+    - result cache savings (--cache, --duplicates)
+    - accuracy on a packed evaluation set (--eval)
+    - concurrent predictors under both thread policies (--concurrent)
+    - latency against offered load through the request batcher (--batcher)
+    - the cost of setting a predictor up for every request (--setup)
+    - the preprocessing kernels against the throwaway interpreter they
+      replaced (--preprocess)
+    - whether the resident set stays flat over a long soak (--soak)
+
+  Build it next to the predictor sources, see README.md. Without --model it
+  runs testdata/tiny.tflite, so run it from the repository root.
+*/
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tensorflow/lite/builtin_op_data.h"
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/kernels/register.h"
+
+#include "predictor.hpp"
+#include "preprocess.hpp"
+
+using std::chrono::steady_clock;
+
+struct Options {
+  std::string model = "testdata/tiny.tflite";
+  std::vector<int> modes = {4};
+  std::vector<int> batches = {1};
+  int warmup = 10;
+  int iterations = 100;
+  bool resize = false; // feed 224x224x3 images instead of the model geometry
+  bool preload = false; // keep the model in the process-wide cache
+  int warm_start = 0; // warm-up invokes run by NewTfliteWarm before the predictor is returned
+  bool uint8 = false; // one byte per element through PredictUInt8Tflite
+  int pipeline = 0; // depth of the asynchronous pipeline run, 0 to skip it
+  size_t cache = 0; // result cache capacity in bytes, 0 to skip the cache runs
+  std::vector<double> duplicates = {0, 0.5, 0.9};
+  std::string eval; // packed evaluation file, see EvaluateTflite
+  int label_offset = 0;
+  int concurrent = 0; // predictors run side by side under each thread policy, 0 to skip
+  std::vector<double> batcher_rates; // offered loads (requests / s) through the batcher, empty to skip
+  int max_wait_us = 1000; // batcher deadline
+  bool setup = false; // also time a predictor created, run once and deleted per request
+  bool preprocess = false; // time the resize kernels on their own, once, independent of the model
+  long long soak = 0; // inferences of the RSS soak, 0 to skip it
+  long soak_max_growth_kb = 1024; // resident set growth a soak may show and still be flat
+};
+
+struct CacheRun {
+  double duplicates; // fraction of requests repeating an earlier image
+  double images_per_sec;
+  double hit_rate;
+};
+
+struct ConcurrentRun {
+  int policy; // PREDICTOR_THREADS_DEFAULT or PREDICTOR_THREADS_SHARED
+  int leased_threads;
+  int oversubscribed_threads; // leased beyond the physical cores
+  double p50_ms, p99_ms; // over the invokes of every predictor
+  double images_per_sec; // all predictors together
+};
+
+struct BatcherRun {
+  double rate; // offered requests per second
+  double p50_ms, p99_ms; // from the scheduled send time to completion
+  double requests_per_sec; // served
+  double mean_batch_size;
+  double mean_queue_delay_us;
+};
+
+struct SoakRun {
+  long long inferences;
+  std::vector<long> rss_kb; // sampled at every tenth of the run, the first after the warmup
+  long growth_kb; // last sample minus first
+  bool flat; // growth_kb <= --soak-max-growth-kb
+};
+
+struct PreprocessRun {
+  int src_size, dst_size; // square, 3 channel images
+  double legacy_ms; // per image, RESIZE_BILINEAR on a throwaway interpreter
+  double float_ms; // per image, ResizeImage float to float with a cached plan
+  double uint8_ms; // per image, ResizeImageQuantized uint8 to uint8
+};
+
+struct Result {
+  int mode;
+  int batch;
+  double load_ms;
+  bool model_cached;
+  double model_ms, interpreter_ms;
+  double first_invoke_ms, warm_invoke_ms;
+  double mean_ms, p50_ms, p90_ms, p99_ms;
+  double images_per_sec;
+  double pipeline_images_per_sec;
+  std::vector<CacheRun> cache_runs;
+  bool evaluated;
+  EvalStats eval;
+  std::vector<ConcurrentRun> concurrent_runs;
+  std::vector<BatcherRun> batcher_runs;
+  bool soaked;
+  SoakRun soak;
+  bool setup_measured;
+  double setup_p50_ms; // NewTflite + one inference + DeleteTflite, model cached
+  long rss_delta_kb; // resident set growth from before the load to the end of the run
+  long process_peak_rss_kb; // high-water mark of the whole process so far, not of this run
+};
+
+static double ElapsedMs(steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+static double Percentile(std::vector<double> sorted, double p) {
+  if(sorted.empty()) {
+    return 0;
+  }
+  const size_t rank = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+  return sorted[rank];
+}
+
+static long PeakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// resident set size right now, from /proc/self/statm; 0 if unavailable
+static long CurrentRssKb() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if(statm == nullptr) {
+    return 0;
+  }
+  long size = 0, resident = 0;
+  const bool read = fscanf(statm, "%ld %ld", &size, &resident) == 2;
+  fclose(statm);
+  return read ? resident * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+static std::vector<int> ParseList(const char* arg) {
+  std::vector<int> values;
+  std::stringstream stream(arg);
+  std::string item;
+  while(std::getline(stream, item, ',')) {
+    values.push_back(atoi(item.c_str()));
+  }
+  return values;
+}
+
+static std::vector<double> ParseRatios(const char* arg) {
+  std::vector<double> values;
+  std::stringstream stream(arg);
+  std::string item;
+  while(std::getline(stream, item, ',')) {
+    values.push_back(atof(item.c_str()));
+  }
+  return values;
+}
+
+static void Usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--model FILE] [--modes 1,4,8] [--batches 1,4,16,32]\n"
+          "          [--warmup N] [--iterations N] [--resize] [--uint8] [--preload] [--warm-start N]\n"
+          "          [--pipeline DEPTH] [--cache BYTES] [--duplicates 0,0.5,0.9] [--eval FILE] [--label-offset N]\n"
+          "          [--concurrent N] [--batcher RATE,RATE] [--max-wait-us N] [--setup] [--preprocess]\n"
+          "          [--soak N] [--soak-max-growth-kb KB]\n", argv0);
+  exit(1);
+}
+
+static Options ParseOptions(int argc, char** argv) {
+  Options options;
+  for(int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if(arg == "--model" && has_value) {
+      options.model = argv[++i];
+    } else if(arg == "--modes" && has_value) {
+      options.modes = ParseList(argv[++i]);
+    } else if(arg == "--batches" && has_value) {
+      options.batches = ParseList(argv[++i]);
+    } else if(arg == "--warmup" && has_value) {
+      options.warmup = atoi(argv[++i]);
+    } else if(arg == "--iterations" && has_value) {
+      options.iterations = atoi(argv[++i]);
+    } else if(arg == "--resize") {
+      options.resize = true;
+    } else if(arg == "--uint8") {
+      options.uint8 = true;
+    } else if(arg == "--preload") {
+      options.preload = true;
+    } else if(arg == "--warm-start" && has_value) {
+      options.warm_start = atoi(argv[++i]);
+    } else if(arg == "--pipeline" && has_value) {
+      options.pipeline = atoi(argv[++i]);
+    } else if(arg == "--cache" && has_value) {
+      options.cache = strtoull(argv[++i], nullptr, 10);
+    } else if(arg == "--duplicates" && has_value) {
+      options.duplicates = ParseRatios(argv[++i]);
+    } else if(arg == "--eval" && has_value) {
+      options.eval = argv[++i];
+    } else if(arg == "--label-offset" && has_value) {
+      options.label_offset = atoi(argv[++i]);
+    } else if(arg == "--concurrent" && has_value) {
+      options.concurrent = atoi(argv[++i]);
+    } else if(arg == "--batcher" && has_value) {
+      options.batcher_rates = ParseRatios(argv[++i]);
+    } else if(arg == "--max-wait-us" && has_value) {
+      options.max_wait_us = atoi(argv[++i]);
+    } else if(arg == "--setup") {
+      options.setup = true;
+    } else if(arg == "--preprocess") {
+      options.preprocess = true;
+    } else if(arg == "--soak" && has_value) {
+      options.soak = atoll(argv[++i]);
+    } else if(arg == "--soak-max-growth-kb" && has_value) {
+      options.soak_max_growth_kb = atol(argv[++i]);
+    } else {
+      Usage(argv[0]);
+    }
+  }
+  if(options.model.empty() || options.iterations < 1 || options.warmup < 0 || options.warm_start < 0) {
+    Usage(argv[0]);
+  }
+  return options;
+}
+
+// options.concurrent predictors of the same mode, each driven by its own
+// thread, with the thread policy set to `policy` while they are created
+static bool RunConcurrent(const Options &options, int mode, int batch, int policy, ConcurrentRun* run) {
+  SetThreadPolicyTflite(policy);
+  std::vector<PredictorContext> preds;
+  for(int i = 0; i < options.concurrent; i++) {
+    PredictorContext pred = NewTflite(const_cast<char*>(options.model.c_str()), batch, mode, false, false);
+    if(pred == nullptr) {
+      break;
+    }
+    preds.push_back(pred);
+  }
+  SetThreadPolicyTflite(PREDICTOR_THREADS_DEFAULT);
+  ThreadStats threads;
+  GetThreadStatsTflite(&threads);
+  run->policy = policy;
+  run->leased_threads = threads.leased_threads;
+  run->oversubscribed_threads = threads.oversubscribed_threads;
+  if((int)preds.size() != options.concurrent) {
+    for(PredictorContext pred : preds) {
+      DeleteTflite(pred);
+    }
+    return false;
+  }
+
+  PredictorTensorInfo input;
+  GetInputTensorTflite(preds[0], &input);
+  const bool quantize = input.type != 1;
+  const ImageGeometry geometry = {GetHeightTflite(preds[0]), GetWidthTflite(preds[0]), GetChannelsTflite(preds[0]),
+                                  PREDICTOR_LAYOUT_HWC, false};
+  const size_t elements = (size_t)batch * geometry.height * geometry.width * geometry.channels;
+  std::vector<int> quantized(elements, 128);
+  std::vector<float> real(elements, 0.5f);
+  std::vector<uint8_t> bytes(elements, 128);
+
+  std::vector<std::vector<double>> latencies(preds.size(), std::vector<double>(options.iterations));
+  std::vector<std::thread> workers;
+  const auto measured = steady_clock::now();
+  for(size_t p = 0; p < preds.size(); p++) {
+    workers.emplace_back([&, p] {
+      for(int i = -options.warmup; i < options.iterations; i++) {
+        const auto start = steady_clock::now();
+        if(options.uint8) {
+          PredictUInt8Tflite(preds[p], bytes.data(), &geometry);
+        } else {
+          PredictImageTflite(preds[p], quantized.data(), real.data(), quantize, &geometry);
+        }
+        if(i >= 0) {
+          latencies[p][i] = ElapsedMs(start);
+        }
+      }
+    });
+  }
+  for(std::thread &worker : workers) {
+    worker.join();
+  }
+  const double total_ms = ElapsedMs(measured);
+
+  std::vector<double> all;
+  for(const std::vector<double> &l : latencies) {
+    all.insert(all.end(), l.begin(), l.end());
+  }
+  std::sort(all.begin(), all.end());
+  run->p50_ms = Percentile(all, 0.50);
+  run->p99_ms = Percentile(all, 0.99);
+  run->images_per_sec = (double)batch * (options.warmup + options.iterations) * preds.size() / (total_ms / 1000);
+  for(PredictorContext pred : preds) {
+    DeleteTflite(pred);
+  }
+  return true;
+}
+
+// Open-loop load through a batcher of max_batch `batch` on a batch 1
+// predictor: request j is due at j / rate seconds whatever the state of the
+// earlier ones, and its latency runs from that due time, so queueing shows
+// up in the percentiles instead of slowing the generator down. kClients
+// threads send the requests round robin.
+static bool RunBatcher(const Options &options, int mode, int batch, double rate, BatcherRun* run) {
+  const int kClients = 64;
+  PredictorContext pred = NewTflite(const_cast<char*>(options.model.c_str()), 1, mode, false, false);
+  if(pred == nullptr) {
+    return false;
+  }
+  BatcherContext batcher = NewBatcherTflite(pred, batch, options.max_wait_us);
+  if(batcher == nullptr) {
+    DeleteTflite(pred);
+    return false;
+  }
+  PredictorTensorInfo input;
+  GetInputTensorTflite(pred, &input);
+  const bool quantize = input.type != 1;
+  const int pred_len = GetPredLenTflite(pred);
+  std::vector<int> quantized(224 * 224 * 3, 128);
+  std::vector<float> real(224 * 224 * 3, 0.5f);
+
+  const int requests = options.iterations;
+  std::vector<double> latencies(requests);
+  std::vector<std::thread> clients;
+  const auto start = steady_clock::now();
+  for(int c = 0; c < kClients && c < requests; c++) {
+    clients.emplace_back([&, c] {
+      std::vector<float> out(pred_len);
+      for(int j = c; j < requests; j += kClients) {
+        const auto due = start + std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(j / rate));
+        std::this_thread::sleep_until(due);
+        PredictBatcherTflite(batcher, quantized.data(), real.data(), quantize, out.data());
+        latencies[j] = ElapsedMs(due);
+      }
+    });
+  }
+  for(std::thread &client : clients) {
+    client.join();
+  }
+  const double total_ms = ElapsedMs(start);
+
+  BatcherStats stats;
+  GetBatcherStatsTflite(batcher, &stats);
+  DeleteBatcherTflite(batcher);
+  DeleteTflite(pred);
+
+  std::sort(latencies.begin(), latencies.end());
+  run->rate = rate;
+  run->p50_ms = Percentile(latencies, 0.50);
+  run->p99_ms = Percentile(latencies, 0.99);
+  run->requests_per_sec = requests / (total_ms / 1000);
+  run->mean_batch_size = stats.mean_batch_size;
+  run->mean_queue_delay_us = stats.mean_queue_delay_us;
+  return true;
+}
+
+// Every request on a predictor of its own: created, run once and deleted.
+// This is the per-request work a prepared predictor does only once (backend
+// and delegate setup, tensor allocation, profiler), plus the interpreter
+// build; the model stays in the shared cache so the file is mapped once.
+static bool RunSetup(const Options &options, int mode, int batch, double* p50_ms) {
+  char* model = const_cast<char*>(options.model.c_str());
+  if(!options.preload && PreloadModelTflite(model) != 0) {
+    return false;
+  }
+  std::vector<double> latencies;
+  std::vector<int> quantized;
+  std::vector<float> real;
+  std::vector<uint8_t> bytes;
+  for(int i = -options.warmup; i < options.iterations; i++) {
+    const auto start = steady_clock::now();
+    PredictorContext pred = NewTflite(model, batch, mode, false, false);
+    if(pred == nullptr) {
+      break;
+    }
+    PredictorTensorInfo input;
+    GetInputTensorTflite(pred, &input);
+    const ImageGeometry geometry = {GetHeightTflite(pred), GetWidthTflite(pred), GetChannelsTflite(pred),
+                                    PREDICTOR_LAYOUT_HWC, false};
+    const size_t elements = (size_t)batch * geometry.height * geometry.width * geometry.channels;
+    quantized.resize(elements, 128);
+    real.resize(elements, 0.5f);
+    bytes.resize(elements, 128);
+    if(options.uint8) {
+      PredictUInt8Tflite(pred, bytes.data(), &geometry);
+    } else {
+      PredictImageTflite(pred, quantized.data(), real.data(), input.type != 1, &geometry);
+    }
+    DeleteTflite(pred);
+    if(i >= 0) {
+      latencies.push_back(ElapsedMs(start));
+    }
+  }
+  if(!options.preload) {
+    UnloadModelTflite(model);
+  }
+  if((int)latencies.size() != options.iterations) {
+    return false;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  *p50_ms = Percentile(latencies, 0.50);
+  return true;
+}
+
+// The resize the predictor ran before the native kernels: a new interpreter
+// with a single RESIZE_BILINEAR node built, allocated and invoked per image
+static void LegacyResize(const float* in, int src_size, float* out, int dst_size) {
+  tflite::Interpreter interpreter;
+  int base_index = 0;
+  interpreter.AddTensors(3, &base_index);
+  interpreter.SetInputs({0, 1});
+  interpreter.SetOutputs({2});
+  TfLiteQuantizationParams quant = {};
+  interpreter.SetTensorParametersReadWrite(0, kTfLiteFloat32, "input", {1, src_size, src_size, 3}, quant);
+  interpreter.SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2}, quant);
+  interpreter.SetTensorParametersReadWrite(2, kTfLiteFloat32, "output", {1, dst_size, dst_size, 3}, quant);
+
+  tflite::ops::builtin::BuiltinOpResolver resolver;
+  const TfLiteRegistration* resize_op = resolver.FindOp(tflite::BuiltinOperator_RESIZE_BILINEAR, 1);
+  // owned, and freed, by the interpreter
+  auto* params = reinterpret_cast<TfLiteResizeBilinearParams*>(malloc(sizeof(TfLiteResizeBilinearParams)));
+  params->align_corners = false;
+  interpreter.AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op, nullptr);
+  interpreter.AllocateTensors();
+
+  std::copy(in, in + src_size * src_size * 3, interpreter.typed_tensor<float>(0));
+  interpreter.typed_tensor<int>(1)[0] = dst_size;
+  interpreter.typed_tensor<int>(1)[1] = dst_size;
+  interpreter.Invoke();
+  const float* resized = interpreter.typed_tensor<float>(2);
+  std::copy(resized, resized + dst_size * dst_size * 3, out);
+}
+
+// Mean time per image of each resize path for one geometry
+static void RunPreprocess(const Options &options, int src_size, int dst_size, PreprocessRun* run) {
+  const size_t src_elements = (size_t)src_size * src_size * 3;
+  std::vector<float> real(src_elements);
+  std::vector<uint8_t> bytes(src_elements);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> pixel(0, 255);
+  for(size_t i = 0; i < src_elements; i++) {
+    bytes[i] = pixel(rng);
+    real[i] = bytes[i] / 255.0f;
+  }
+  std::vector<float> real_out((size_t)dst_size * dst_size * 3);
+  std::vector<uint8_t> bytes_out(real_out.size());
+
+  ResizePlan plan;
+  BuildResizePlan(src_size, src_size, dst_size, dst_size, &plan);
+  SourceFormat float_format;
+  float_format.type = kSourceFloat32;
+  SourceFormat uint8_format;
+  uint8_format.type = kSourceUInt8;
+  const Normalization norm;
+  QuantTable table;
+  BuildQuantTable(kTargetUInt8, &table);
+
+  auto time = [&](const std::function<void()> &resize) {
+    for(int i = 0; i < options.warmup; i++) {
+      resize();
+    }
+    const auto start = steady_clock::now();
+    for(int i = 0; i < options.iterations; i++) {
+      resize();
+    }
+    return ElapsedMs(start) / options.iterations;
+  };
+  run->src_size = src_size;
+  run->dst_size = dst_size;
+  run->legacy_ms = time([&] { LegacyResize(real.data(), src_size, real_out.data(), dst_size); });
+  run->float_ms = time([&] {
+    ResizeImage(real.data(), float_format, real_out.data(), kTargetFloat32, 3, plan, norm);
+  });
+  run->uint8_ms = time([&] {
+    ResizeImageQuantized(bytes.data(), uint8_format, bytes_out.data(), 3, plan, table);
+  });
+}
+
+static bool Run(const Options &options, int mode, int batch, Result* result) {
+  result->mode = mode;
+  result->batch = batch;
+  const long rss_before_kb = CurrentRssKb();
+
+  auto start = steady_clock::now();
+  PredictorContext pred = NewTfliteWarm(const_cast<char*>(options.model.c_str()), batch, mode, false, false,
+                                        options.warm_start);
+  result->load_ms = ElapsedMs(start);
+  if(pred == nullptr) {
+    fprintf(stderr, "failed to load %s (mode %d, batch %d)\n", options.model.c_str(), mode, batch);
+    return false;
+  }
+
+  PredictorTensorInfo input;
+  if(GetInputTensorTflite(pred, &input) != 0) {
+    DeleteTflite(pred);
+    return false;
+  }
+  const bool quantize = input.type != 1; // anything but float32
+
+  ImageGeometry geometry = {224, 224, 3, PREDICTOR_LAYOUT_HWC, false};
+  if(!options.resize) {
+    geometry.height = GetHeightTflite(pred);
+    geometry.width = GetWidthTflite(pred);
+    geometry.channels = GetChannelsTflite(pred);
+  }
+
+  // synthetic pixels; only the array matching the input type is read
+  const size_t elements = (size_t)batch * geometry.height * geometry.width * geometry.channels;
+  std::vector<int> quantized(elements);
+  std::vector<float> real(elements);
+  std::vector<uint8_t> bytes(elements);
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> pixel(0, 255);
+  for(size_t i = 0; i < elements; i++) {
+    quantized[i] = pixel(rng);
+    real[i] = quantized[i] / 255.0f;
+    bytes[i] = quantized[i];
+  }
+  auto predict = [&]() {
+    if(options.uint8) {
+      PredictUInt8Tflite(pred, bytes.data(), &geometry);
+    } else {
+      PredictImageTflite(pred, quantized.data(), real.data(), quantize, &geometry);
+    }
+  };
+
+  start = steady_clock::now();
+  predict();
+  result->first_invoke_ms = ElapsedMs(start);
+
+  for(int i = 0; i < options.warmup; i++) {
+    predict();
+  }
+
+  StartupStats startup;
+  GetStartupStatsTflite(pred, &startup);
+  result->model_cached = startup.model_cached;
+  result->model_ms = startup.model_ms;
+  result->interpreter_ms = startup.interpreter_ms;
+  result->warm_invoke_ms = startup.warm_invoke_ms;
+
+  std::vector<double> latencies(options.iterations);
+  const auto measured = steady_clock::now();
+  for(int i = 0; i < options.iterations; i++) {
+    start = steady_clock::now();
+    predict();
+    latencies[i] = ElapsedMs(start);
+  }
+  const double total_ms = ElapsedMs(measured);
+
+  std::sort(latencies.begin(), latencies.end());
+  double sum = 0;
+  for(double latency : latencies) {
+    sum += latency;
+  }
+  result->mean_ms = sum / latencies.size();
+  result->p50_ms = Percentile(latencies, 0.50);
+  result->p90_ms = Percentile(latencies, 0.90);
+  result->p99_ms = Percentile(latencies, 0.99);
+  result->images_per_sec = (double)batch * options.iterations / (total_ms / 1000);
+
+  // sustained throughput with preprocessing, invoke and top-K overlapped
+  result->pipeline_images_per_sec = 0;
+  if(options.pipeline > 0) {
+    PipelineContext pipeline = NewPipelineTflite(pred, options.pipeline, 5);
+    std::vector<int> indices(batch * 5);
+    std::vector<float> scores(batch * 5);
+    const auto streamed = steady_clock::now();
+    for(int i = 0; i < options.iterations; i++) {
+      // every request shares the same buffers: only top-K is read back
+      SubmitTflite(pipeline, quantized.data(), real.data(), quantize, &geometry,
+                   nullptr, indices.data(), scores.data(), nullptr, nullptr);
+      while(PollTflite(pipeline, nullptr, nullptr, false) == 1) {}
+    }
+    while(PollTflite(pipeline, nullptr, nullptr, true) == 1) {}
+    result->pipeline_images_per_sec = (double)batch * options.iterations / (ElapsedMs(streamed) / 1000);
+    DeletePipelineTflite(pipeline);
+  }
+
+  // result cache savings: each request repeats an earlier image with
+  // probability `ratio`, otherwise it is a new image (distinct first pixels)
+  for(double ratio : options.cache > 0 ? options.duplicates : std::vector<double>()) {
+    EnableResultCacheTflite(pred, options.cache); // fresh, empty cache
+    std::bernoulli_distribution repeat(ratio);
+    int distinct = 0;
+    const auto cached = steady_clock::now();
+    for(int i = 0; i < options.iterations; i++) {
+      const int image = distinct > 0 && repeat(rng) ? (int)(rng() % distinct) : distinct++;
+      for(int c = 0; c < 3 && c < (int)elements; c++) {
+        quantized[c] = (image >> (8 * c)) & 0xff;
+        real[c] = quantized[c] / 255.0f;
+        bytes[c] = quantized[c];
+      }
+      predict();
+    }
+    const double cached_ms = ElapsedMs(cached);
+    ResultCacheStats stats;
+    GetResultCacheStatsTflite(pred, &stats);
+    CacheRun run;
+    run.duplicates = ratio;
+    run.images_per_sec = (double)batch * options.iterations / (cached_ms / 1000);
+    run.hit_rate = stats.hits + stats.misses > 0 ? (double)stats.hits / (stats.hits + stats.misses) : 0;
+    result->cache_runs.push_back(run);
+  }
+  EnableResultCacheTflite(pred, 0);
+
+  result->evaluated = !options.eval.empty() &&
+                      EvaluateTflite(pred, const_cast<char*>(options.eval.c_str()), options.label_offset, 0, &result->eval) == 0;
+  // long run on the same predictor, reading every output back as a client
+  // would: per-inference allocations that are never freed show up as growth
+  result->soaked = options.soak > 0;
+  if(result->soaked) {
+    SoakRun &soak = result->soak;
+    soak.inferences = options.soak;
+    const int outputs = GetOutputCountTflite(pred);
+    for(long long i = 0; i < options.soak; i++) {
+      if(i % std::max(1LL, options.soak / 10) == 0) {
+        soak.rss_kb.push_back(CurrentRssKb());
+      }
+      predict();
+      for(int o = 0; o < outputs; o++) {
+        GetOutputTflite(pred, o);
+      }
+    }
+    soak.rss_kb.push_back(CurrentRssKb());
+    soak.growth_kb = soak.rss_kb.back() - soak.rss_kb.front();
+    soak.flat = soak.growth_kb <= options.soak_max_growth_kb;
+  }
+  result->rss_delta_kb = CurrentRssKb() - rss_before_kb;
+  DeleteTflite(pred);
+
+  for(int policy : {PREDICTOR_THREADS_DEFAULT, PREDICTOR_THREADS_SHARED}) {
+    ConcurrentRun run;
+    if(options.concurrent > 0 && RunConcurrent(options, mode, batch, policy, &run)) {
+      result->concurrent_runs.push_back(run);
+    }
+  }
+  for(double rate : options.batcher_rates) {
+    BatcherRun run;
+    if(rate > 0 && RunBatcher(options, mode, batch, rate, &run)) {
+      result->batcher_runs.push_back(run);
+    }
+  }
+  result->setup_measured = options.setup && RunSetup(options, mode, batch, &result->setup_p50_ms);
+  result->process_peak_rss_kb = PeakRssKb();
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const Options options = ParseOptions(argc, argv);
+  InitTflite();
+  if(options.preload && PreloadModelTflite(const_cast<char*>(options.model.c_str())) != 0) {
+    fprintf(stderr, "failed to load %s\n", options.model.c_str());
+    return 1;
+  }
+
+  std::vector<Result> results;
+  for(int mode : options.modes) {
+    for(int batch : options.batches) {
+      Result result;
+      if(Run(options, mode, batch, &result)) {
+        results.push_back(result);
+      }
+    }
+  }
+
+  printf("{\n  \"model\": \"%s\",\n  \"warmup\": %d,\n  \"warm_start\": %d,\n  \"iterations\": %d,\n  \"results\": [\n",
+         options.model.c_str(), options.warmup, options.warm_start, options.iterations);
+  for(size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    printf("    {\"mode\": %d, \"batch\": %d, \"load_ms\": %.3f, \"model_cached\": %s, "
+           "\"model_ms\": %.3f, \"interpreter_ms\": %.3f, \"first_invoke_ms\": %.3f, \"warm_invoke_ms\": %.3f, "
+           "\"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, "
+           "\"images_per_sec\": %.2f, \"pipeline_images_per_sec\": %.2f, \"cache\": [",
+           r.mode, r.batch, r.load_ms, r.model_cached ? "true" : "false",
+           r.model_ms, r.interpreter_ms, r.first_invoke_ms, r.warm_invoke_ms,
+           r.mean_ms, r.p50_ms, r.p90_ms, r.p99_ms,
+           r.images_per_sec, r.pipeline_images_per_sec);
+    for(size_t j = 0; j < r.cache_runs.size(); j++) {
+      const CacheRun &run = r.cache_runs[j];
+      printf("{\"duplicates\": %.2f, \"images_per_sec\": %.2f, \"hit_rate\": %.3f}%s",
+             run.duplicates, run.images_per_sec, run.hit_rate, j + 1 < r.cache_runs.size() ? ", " : "");
+    }
+    printf("], ");
+    if(r.evaluated) {
+      printf("\"eval\": {\"images\": %lld, \"top1\": %.4f, \"top5\": %.4f, \"images_per_sec\": %.2f, "
+             "\"invoke_ms\": %.3f, \"prefetch_wait_ms\": %.3f}, ",
+             r.eval.images, r.eval.top1_accuracy, r.eval.top5_accuracy, r.eval.images_per_sec,
+             r.eval.invoke_ms, r.eval.prefetch_wait_ms);
+    }
+    printf("\"concurrent\": [");
+    for(size_t j = 0; j < r.concurrent_runs.size(); j++) {
+      const ConcurrentRun &run = r.concurrent_runs[j];
+      printf("{\"policy\": \"%s\", \"predictors\": %d, \"leased_threads\": %d, \"oversubscribed_threads\": %d, "
+             "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"images_per_sec\": %.2f}%s",
+             run.policy == PREDICTOR_THREADS_SHARED ? "shared" : "default", options.concurrent, run.leased_threads,
+             run.oversubscribed_threads, run.p50_ms, run.p99_ms, run.images_per_sec, j + 1 < r.concurrent_runs.size() ? ", " : "");
+    }
+    printf("], ");
+    if(r.soaked) {
+      printf("\"soak\": {\"inferences\": %lld, \"rss_kb\": [", r.soak.inferences);
+      for(size_t j = 0; j < r.soak.rss_kb.size(); j++) {
+        printf("%ld%s", r.soak.rss_kb[j], j + 1 < r.soak.rss_kb.size() ? ", " : "");
+      }
+      printf("], \"growth_kb\": %ld, \"flat\": %s}, ", r.soak.growth_kb, r.soak.flat ? "true" : "false");
+    }
+    if(r.setup_measured) {
+      printf("\"setup\": {\"per_request_p50_ms\": %.3f, \"prepared_p50_ms\": %.3f, \"overhead_ms\": %.3f}, ",
+             r.setup_p50_ms, r.p50_ms, r.setup_p50_ms - r.p50_ms);
+    }
+    printf("\"batcher\": [");
+    for(size_t j = 0; j < r.batcher_runs.size(); j++) {
+      const BatcherRun &run = r.batcher_runs[j];
+      printf("{\"rate\": %.1f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"requests_per_sec\": %.2f, "
+             "\"mean_batch_size\": %.2f, \"mean_queue_delay_us\": %.1f}%s",
+             run.rate, run.p50_ms, run.p99_ms, run.requests_per_sec, run.mean_batch_size, run.mean_queue_delay_us,
+             j + 1 < r.batcher_runs.size() ? ", " : "");
+    }
+    printf("], ");
+    printf("\"rss_delta_kb\": %ld, \"process_peak_rss_kb\": %ld}%s\n", r.rss_delta_kb, r.process_peak_rss_kb, i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]");
+  if(options.preprocess) {
+    printf(",\n  \"preprocess\": {\"kernel\": \"%s\", \"runs\": [\n", PreprocessKernelName());
+    const int sizes[][2] = {{224, 299}, {640, 224}};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      PreprocessRun run;
+      RunPreprocess(options, sizes[i][0], sizes[i][1], &run);
+      printf("    {\"src\": %d, \"dst\": %d, \"legacy_ms\": %.4f, \"float_ms\": %.4f, \"uint8_ms\": %.4f}%s\n",
+             run.src_size, run.dst_size, run.legacy_ms, run.float_ms, run.uint8_ms,
+             i + 1 < sizeof(sizes) / sizeof(sizes[0]) ? "," : "");
+    }
+    printf("  ]}");
+  }
+  printf("\n}\n");
+  for(const Result &r : results) {
+    if(r.soaked && !r.soak.flat) {
+      fprintf(stderr, "RSS grew by %ld KB over %lld inferences (mode %d, batch %d)\n",
+              r.soak.growth_kb, r.soak.inferences, r.mode, r.batch);
+      return 1;
+    }
+  }
+  return results.empty() ? 1 : 0;
+}
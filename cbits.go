@@ -5,16 +5,15 @@ package tflite
 // #include "cbits/predictor.hpp"
 import "C"
 import (
-	"bufio"
 	"fmt"
-	"os"
-	"sort"
+	"reflect"
+	"strings"
+	"sync"
+	"syscall"
 	"unsafe"
 
 	"github.com/Unknwon/com"
 	"github.com/pkg/errors"
-	"github.com/rai-project/dlframework"
-	"github.com/rai-project/dlframework/framework/feature"
 )
 
 // Hardware Modes
@@ -29,13 +28,23 @@ const (
 	CPU_8_thread = 8
 	GPU          = 9
 	NNAPI        = 10
+
+	// XNNPACK delegate, when TFLite is built with it (TFLITE_HAS_XNNPACK)
+	XNNPACK_1_thread = 11
+	XNNPACK_2_thread = 12
+	XNNPACK_4_thread = 14
+	XNNPACK_8_thread = 18
+
+	// Benchmark the CPU modes on the model at load time and keep the fastest
+	AUTO = 19
 )
 
 // Predictor Structure definition
 type PredictorData struct {
-	ctx   C.PredictorContext
-	mode  int
-	batch int
+	ctx       C.PredictorContext
+	mode      int
+	batch     int
+	labelFile string // label file loaded into ctx
 }
 
 // Make access to mode and batch public
@@ -51,114 +60,1346 @@ func NewPredictorData() *PredictorData {
 
 // Create new predictor
 func New(model string, mode, batch int, verbose bool, profile bool) (*PredictorData, error) {
+	return NewWarm(model, mode, batch, verbose, profile, 0)
+}
+
+// Create a new predictor and run warmup inferences on dummy input before
+// returning it, so that its first real request is served at steady-state
+// latency (see Warmup)
+func NewWarm(model string, mode, batch int, verbose bool, profile bool, warmup int) (*PredictorData, error) {
 
 	modelFile := model
 	if !com.IsFile(modelFile) {
 		return nil, errors.Errorf("file %s not found", modelFile)
 	}
 
+	cModelFile := C.CString(modelFile)
+	defer C.free(unsafe.Pointer(cModelFile))
+
+	ctx, err := C.NewTfliteWarm(
+		cModelFile,
+		C.int(batch),
+		C.int(mode),
+		C.bool(verbose),
+		C.bool(profile),
+		C.int(warmup),
+	)
+	if ctx == nil {
+		return nil, errors.Wrapf(err, "unable to create predictor for %s", modelFile)
+	}
+
 	return &PredictorData{
-		ctx: C.NewTflite(
-			C.CString(modelFile),
-			C.int(batch),
-			C.int(mode),
-			C.bool(verbose),
-			C.bool(profile),
-		),
+		ctx:   ctx,
 		mode:  mode,
 		batch: batch,
 	}, nil
 }
 
+// Map a model into the process-wide cache and keep it there, so that
+// predictors created on it later skip the load
+func PreloadModel(model string) error {
+
+	cModel := C.CString(model)
+	defer C.free(unsafe.Pointer(cModel))
+	if C.PreloadModelTflite(cModel) != 0 {
+		return errors.Errorf("unable to load model %s", model)
+	}
+
+	return nil
+}
+
+// Release a model kept by PreloadModel
+func UnloadModel(model string) {
+	cModel := C.CString(model)
+	defer C.free(unsafe.Pointer(cModel))
+	C.UnloadModelTflite(cModel)
+}
+
+// Run invokes inferences on dummy input, so that the first real request is
+// served at steady-state latency
+func Warmup(p *PredictorData, invokes int) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+
+	C.WarmupTflite(p.ctx, C.int(invokes))
+
+	return nil
+}
+
+// Cold start breakdown of a predictor
+type StartupStats struct {
+	Mode          int
+	ProbeMs       float64
+	ModelCached   bool
+	ModelMs       float64
+	InterpreterMs float64
+	FirstInvokeMs float64
+	WarmInvokeMs  float64
+	WarmupInvokes int
+}
+
+// Return the time spent loading the model and building the interpreter, and
+// the latency of the first two invokes
+func GetStartupStats(p *PredictorData) StartupStats {
+
+	if p.ctx == nil {
+		return StartupStats{}
+	}
+
+	var cStats C.StartupStats
+	C.GetStartupStatsTflite(p.ctx, &cStats)
+
+	return StartupStats{
+		Mode:          int(cStats.mode),
+		ProbeMs:       float64(cStats.probe_ms),
+		ModelCached:   bool(cStats.model_cached),
+		ModelMs:       float64(cStats.model_ms),
+		InterpreterMs: float64(cStats.interpreter_ms),
+		FirstInvokeMs: float64(cStats.first_invoke_ms),
+		WarmInvokeMs:  float64(cStats.warm_invoke_ms),
+		WarmupInvokes: int(cStats.warmup_invokes),
+	}
+}
+
+// Thread policies, see SetThreadPolicy
+const (
+	ThreadsDefault = 0 // every predictor runs the threads of its mode, unpinned
+	ThreadsShared  = 1 // threads leased from one budget of physical cores, pinned
+)
+
+// Set the thread policy of predictors created afterwards. With ThreadsShared
+// the CPU threads of all predictors and pool instances together stay within
+// the physical cores: each gets at most the threads of its mode, at least
+// one, pinned to the least loaded of the fastest cores. That one thread is
+// granted even when every core is taken, so more predictors than cores
+// over-subscribe them; ThreadStats.OversubscribedThreads counts the excess.
+func SetThreadPolicy(policy int) error {
+	if policy != ThreadsDefault && policy != ThreadsShared {
+		return errors.Errorf("invalid thread policy %d", policy)
+	}
+	C.SetThreadPolicyTflite(C.int(policy))
+	return nil
+}
+
+// CPU topology and thread budget
+type ThreadStats struct {
+	Policy        int
+	OnlineCpus    int
+	UsableCpus    int
+	PhysicalCores int
+	LeasedThreads int
+	// leased beyond PhysicalCores, sharing cores with other predictors
+	OversubscribedThreads int
+	MaxFreqKHz            int64
+}
+
+// Return the CPU topology seen by the predictors and the threads leased
+// under ThreadsShared
+func GetThreadStats() ThreadStats {
+
+	var cStats C.ThreadStats
+	C.GetThreadStatsTflite(&cStats)
+
+	return ThreadStats{
+		Policy:                int(cStats.policy),
+		OnlineCpus:            int(cStats.online_cpus),
+		UsableCpus:            int(cStats.usable_cpus),
+		PhysicalCores:         int(cStats.physical_cores),
+		LeasedThreads:         int(cStats.leased_threads),
+		OversubscribedThreads: int(cStats.oversubscribed_threads),
+		MaxFreqKHz:            int64(cStats.max_freq_khz),
+	}
+}
+
+// Pin the predictor's invokes and its builtin kernel threads to cpus, or
+// unpin it when cpus is empty
+func SetAffinity(p *PredictorData, cpus []int) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+
+	cCpus := make([]C.int, len(cpus)+1)
+	for ii, cpu := range cpus {
+		cCpus[ii] = C.int(cpu)
+	}
+	if C.SetAffinityTflite(p.ctx, &cCpus[0], C.int(len(cpus))) != 0 {
+		return errors.Errorf("invalid cpus %v", cpus)
+	}
+
+	return nil
+}
+
 // Initialize TFLite
 func init() {
 	C.InitTflite()
 }
 
-// Run inference
+// Image layouts
+const (
+	LayoutHWC = 0
+	LayoutCHW = 1
+)
+
+// Geometry of the source images passed to PredictImage
+type ImageGeometry struct {
+	Height   int
+	Width    int
+	Channels int
+	Layout   int  // LayoutHWC or LayoutCHW
+	BGR      bool // channels are stored BGR rather than RGB
+}
+
+// Geometry Predict assumes
+var DefaultGeometry = ImageGeometry{Height: 224, Width: 224, Channels: 3, Layout: LayoutHWC}
+
+// Run inference on a batch of p.batch 224x224x3 images laid out back to back
 func Predict(p *PredictorData, data []byte, quantize bool) error {
+	return PredictImage(p, data, quantize, DefaultGeometry)
+}
+
+// Run inference on a batch of p.batch images of the given geometry laid out
+// back to back. Images that already match the model input are copied as is,
+// anything else is resized in C++ using a cached resize plan.
+func PredictImage(p *PredictorData, data []byte, quantize bool, geometry ImageGeometry) error {
+
+	cGeometry, err := checkImages(p, data, geometry, 4)
+	if err != nil {
+		return err
+	}
+
+	ptr_quantize := (*C.int)(unsafe.Pointer(&data[0]))
+	ptr_float := (*C.float)(unsafe.Pointer(&data[0]))
+	C.PredictImageTflite(p.ctx, ptr_quantize, ptr_float, C.bool(quantize), &cGeometry)
+
+	return nil
+}
+
+// Run inference on a batch of p.batch images with one byte per element,
+// such as decoded pixels. Quantized models take them as their uint8 input
+// (int8 models with the -128 offset) through an integer only resize; a
+// quarter of the memory traffic of Predict.
+func PredictUInt8(p *PredictorData, data []byte, geometry ImageGeometry) error {
+
+	cGeometry, err := checkImages(p, data, geometry, 1)
+	if err != nil {
+		return err
+	}
+
+	C.PredictUInt8Tflite(p.ctx, (*C.uint8_t)(unsafe.Pointer(&data[0])), &cGeometry)
+
+	return nil
+}
+
+// Normalize the float32 inputs of p: each value becomes
+// (pixel - mean[c]) * scale[c], fused into preprocessing. mean and scale
+// hold 1 to 4 channels, repeated across wider inputs; nil for both restores
+// the identity. Quantized inputs are never normalized.
+func SetNormalization(p *PredictorData, mean, scale []float32) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+	if len(mean) != len(scale) {
+		return errors.Errorf("%d means for %d scales", len(mean), len(scale))
+	}
+
+	var ptrMean, ptrScale *C.float
+	if len(mean) > 0 {
+		ptrMean = (*C.float)(unsafe.Pointer(&mean[0]))
+		ptrScale = (*C.float)(unsafe.Pointer(&scale[0]))
+	}
+	if C.SetNormalizationTflite(p.ctx, ptrMean, ptrScale, C.int(len(mean))) != 0 {
+		return errors.Errorf("invalid normalization for %d channels", len(mean))
+	}
+
+	return nil
+}
+
+// Validate a batch of images of elementSize bytes per element against
+// geometry and convert the geometry
+func checkImages(p *PredictorData, data []byte, geometry ImageGeometry, elementSize int) (C.ImageGeometry, error) {
 
 	if len(data) == 0 {
-		return fmt.Errorf("image data is empty")
+		return C.ImageGeometry{}, fmt.Errorf("image data is empty")
+	}
+
+	if geometry.Height <= 0 || geometry.Width <= 0 || geometry.Channels <= 0 {
+		return C.ImageGeometry{}, fmt.Errorf("invalid image geometry %dx%dx%d", geometry.Height, geometry.Width, geometry.Channels)
+	}
+	if geometry.Layout != LayoutHWC && geometry.Layout != LayoutCHW {
+		return C.ImageGeometry{}, fmt.Errorf("invalid image layout %d", geometry.Layout)
+	}
+
+	expected := p.batch * geometry.Height * geometry.Width * geometry.Channels * elementSize
+	if len(data) < expected {
+		return C.ImageGeometry{}, fmt.Errorf("image data has %d bytes, expected %d for batch size %d", len(data), expected, p.batch)
+	}
+
+	return C.ImageGeometry{
+		height:   C.int(geometry.Height),
+		width:    C.int(geometry.Width),
+		channels: C.int(geometry.Channels),
+		layout:   C.int(geometry.Layout),
+		bgr:      C.bool(geometry.BGR),
+	}, nil
+}
+
+// Output tensor written by PredictInto: out[Offset:Offset+Len], dequantized
+type OutputShape struct {
+	Offset int
+	Len    int
+	Shape  []int
+}
+
+// Run inference on a batch of images and write every output tensor, as
+// float, into out with a single cgo call. out is grown when it is too short
+// (pass nil on the first call) and returned: reuse it on the next call to
+// avoid any allocation.
+func PredictInto(p *PredictorData, data []byte, quantize bool, geometry ImageGeometry, out []float32) ([]float32, []OutputShape, error) {
+
+	if p.ctx == nil {
+		return out, nil, errors.New("empty predictor context")
+	}
+
+	cGeometry, err := checkImages(p, data, geometry, 4)
+	if err != nil {
+		return out, nil, err
 	}
 
 	ptr_quantize := (*C.int)(unsafe.Pointer(&data[0]))
 	ptr_float := (*C.float)(unsafe.Pointer(&data[0]))
-	if quantize == true {
-		C.PredictTflite(p.ctx, ptr_quantize, ptr_float, true)
+	var result C.PredictResult
+	for {
+		var ptr_out *C.float
+		if len(out) > 0 {
+			ptr_out = (*C.float)(unsafe.Pointer(&out[0]))
+		}
+		if C.PredictIntoTflite(p.ctx, ptr_quantize, ptr_float, C.bool(quantize), &cGeometry, C.int(p.batch),
+			ptr_out, C.size_t(len(out)), &result) == 0 {
+			break
+		}
+		if int(result.total_len) <= len(out) || result.total_len == 0 {
+			return out, nil, errors.New("unable to run inference")
+		}
+		out = make([]float32, int(result.total_len))
+	}
+
+	numOutputs := int(result.num_outputs)
+	if numOutputs > C.PREDICTOR_MAX_OUTPUTS {
+		numOutputs = C.PREDICTOR_MAX_OUTPUTS
+	}
+	shapes := make([]OutputShape, numOutputs)
+	for ii := range shapes {
+		shape := make([]int, int(result.num_dims[ii]))
+		for jj := range shape {
+			shape[jj] = int(result.dims[ii][jj])
+		}
+		shapes[ii] = OutputShape{
+			Offset: int(result.offset[ii]),
+			Len:    int(result.len[ii]),
+			Shape:  shape,
+		}
+	}
+
+	return out[:int(result.total_len)], shapes, nil
+}
+
+// Slices aliasing length elements of C memory at ptr, with no upper bound
+// on the length (unlike a cast to a fixed size array)
+func cBytes(ptr unsafe.Pointer, length int) []byte {
+	var slice []byte
+	header := (*reflect.SliceHeader)(unsafe.Pointer(&slice))
+	header.Data, header.Len, header.Cap = uintptr(ptr), length, length
+	return slice
+}
+
+func cFloats(ptr unsafe.Pointer, length int) []float32 {
+	var slice []float32
+	header := (*reflect.SliceHeader)(unsafe.Pointer(&slice))
+	header.Data, header.Len, header.Cap = uintptr(ptr), length, length
+	return slice
+}
+
+func cInts(ptr unsafe.Pointer, length int) []C.int {
+	var slice []C.int
+	header := (*reflect.SliceHeader)(unsafe.Pointer(&slice))
+	header.Data, header.Len, header.Cap = uintptr(ptr), length, length
+	return slice
+}
+
+// Tensor description
+type TensorInfo struct {
+	Name      string
+	Type      int // TfLiteType: 1 float32, 2 int32, 3 uint8, 9 int8
+	Shape     []int
+	Scale     float32
+	ZeroPoint int
+}
+
+func newTensorInfo(info *C.PredictorTensorInfo) TensorInfo {
+	shape := make([]int, int(info.num_dims))
+	for ii := range shape {
+		shape[ii] = int(info.dims[ii])
+	}
+
+	return TensorInfo{
+		Name:      C.GoString(info.name),
+		Type:      int(info._type),
+		Shape:     shape,
+		Scale:     float32(info.scale),
+		ZeroPoint: int(info.zero_point),
+	}
+}
+
+// Return the interpreter's input tensor as a byte slice together with its
+// description. Writing preprocessed data (in the tensor's own type and
+// layout) into the slice and calling PredictInPlace avoids any intermediate
+// copy. The slice aliases C memory: it is only valid until Close.
+func InputTensor(p *PredictorData) ([]byte, TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, TensorInfo{}, errors.New("empty predictor context")
+	}
+
+	var info C.PredictorTensorInfo
+	if C.GetInputTensorTflite(p.ctx, &info) != 0 || info.data == nil {
+		return nil, TensorInfo{}, errors.New("unable to read input tensor")
+	}
+
+	length := int(info.bytes)
+	buffer := cBytes(info.data, length)
+
+	return buffer, newTensorInfo(&info), nil
+}
+
+// Run inference on whatever was written into the InputTensor buffer
+func PredictInPlace(p *PredictorData) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+
+	C.InvokeTflite(p.ctx)
+
+	return nil
+}
+
+// Return the number of output tensors of the model
+func NumOutputs(p *PredictorData) int {
+	if p.ctx == nil {
+		return 0
+	}
+	return int(C.GetOutputCountTflite(p.ctx))
+}
+
+// Return a copy of output tensor index of the last inference, dequantized
+// to float, together with its description
+func ReadOutput(p *PredictorData, index int) ([]float32, TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, TensorInfo{}, errors.New("empty predictor context")
+	}
+
+	var info C.PredictorTensorInfo
+	if C.GetOutputTensorTflite(p.ctx, C.int(index), &info) != 0 {
+		return nil, TensorInfo{}, errors.Errorf("unable to read output tensor %d", index)
+	}
+
+	length := int(C.GetOutputLenTflite(p.ctx, C.int(index)))
+	cOutput := C.GetOutputTflite(p.ctx, C.int(index))
+	if length == 0 || cOutput == nil {
+		return nil, TensorInfo{}, errors.Errorf("empty output tensor %d", index)
+	}
+
+	output := make([]float32, length)
+	copy(output, cFloats(unsafe.Pointer(cOutput), length))
+
+	return output, newTensorInfo(&info), nil
+}
+
+// Describe every input of the model, in model order
+func Inputs(p *PredictorData) ([]TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, errors.New("empty predictor context")
+	}
+
+	inputs := make([]TensorInfo, int(C.GetInputCountTflite(p.ctx)))
+	for ii := range inputs {
+		var info C.PredictorTensorInfo
+		if C.GetInputTensorAtTflite(p.ctx, C.int(ii), &info) != 0 {
+			return nil, errors.Errorf("unable to read input tensor %d", ii)
+		}
+		inputs[ii] = newTensorInfo(&info)
+	}
+
+	return inputs, nil
+}
+
+// Describe every output of the model, in model order
+func Outputs(p *PredictorData) ([]TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, errors.New("empty predictor context")
+	}
+
+	outputs := make([]TensorInfo, int(C.GetOutputCountTflite(p.ctx)))
+	for ii := range outputs {
+		var info C.PredictorTensorInfo
+		if C.GetOutputTensorTflite(p.ctx, C.int(ii), &info) != 0 {
+			return nil, errors.Errorf("unable to read output tensor %d", ii)
+		}
+		outputs[ii] = newTensorInfo(&info)
+	}
+
+	return outputs, nil
+}
+
+// Return the index of the input or output tensor called name
+func FindTensor(p *PredictorData, name string, output bool) (int, error) {
+
+	if p.ctx == nil {
+		return -1, errors.New("empty predictor context")
+	}
+
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+
+	var index C.int
+	if output {
+		index = C.FindOutputTflite(p.ctx, cName)
 	} else {
-		C.PredictTflite(p.ctx, ptr_quantize, ptr_float, false)
+		index = C.FindInputTflite(p.ctx, cName)
+	}
+	if index < 0 {
+		return -1, errors.Errorf("no tensor named %s", name)
+	}
+
+	return int(index), nil
+}
+
+// Return input tensor index as a byte slice aliasing the interpreter's
+// memory, like InputTensor. Valid until the next ResizeInput or Close.
+func InputTensorAt(p *PredictorData, index int) ([]byte, TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, TensorInfo{}, errors.New("empty predictor context")
+	}
+
+	var info C.PredictorTensorInfo
+	if C.GetInputTensorAtTflite(p.ctx, C.int(index), &info) != 0 || info.data == nil {
+		return nil, TensorInfo{}, errors.Errorf("unable to read input tensor %d", index)
+	}
+
+	length := int(info.bytes)
+	buffer := cBytes(info.data, length)
+
+	return buffer, newTensorInfo(&info), nil
+}
+
+// Return output tensor index, in its own type, as a byte slice aliasing the
+// interpreter's memory. It holds the result of the last inference and is
+// valid until the next ResizeInput or Close.
+func OutputTensorAt(p *PredictorData, index int) ([]byte, TensorInfo, error) {
+
+	if p.ctx == nil {
+		return nil, TensorInfo{}, errors.New("empty predictor context")
+	}
+
+	var info C.PredictorTensorInfo
+	if C.GetOutputTensorTflite(p.ctx, C.int(index), &info) != 0 || info.data == nil {
+		return nil, TensorInfo{}, errors.Errorf("unable to read output tensor %d", index)
+	}
+
+	length := int(info.bytes)
+	buffer := cBytes(info.data, length)
+
+	return buffer, newTensorInfo(&info), nil
+}
+
+// Resize input tensor index to shape. Tensors are reallocated only when the
+// shape changes, which invalidates slices returned by InputTensorAt and
+// OutputTensorAt.
+func ResizeInput(p *PredictorData, index int, shape []int) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+	if len(shape) == 0 || len(shape) > C.PREDICTOR_MAX_DIMS {
+		return errors.Errorf("invalid shape %v", shape)
+	}
+
+	var cShape [C.PREDICTOR_MAX_DIMS]C.int
+	for ii, dim := range shape {
+		cShape[ii] = C.int(dim)
+	}
+	if C.ResizeInputTflite(p.ctx, C.int(index), &cShape[0], C.int(len(shape))) != 0 {
+		return errors.Errorf("unable to resize input %d to %v", index, shape)
+	}
+
+	// the image API follows input 0
+	var info C.PredictorTensorInfo
+	if C.GetInputTensorTflite(p.ctx, &info) == 0 && info.num_dims == 4 {
+		p.batch = int(info.dims[0])
 	}
 
 	return nil
 }
 
-// Return Top-5 predicted label
-func ReadPredictionOutput(p *PredictorData, labelFile string) (string, error) {
+// Choose whether PredictInPlace converts every output to float (the
+// default). Callers reading outputs through OutputTensorAt can turn it off.
+func SetReadOutputs(p *PredictorData, read bool) {
+	C.SetReadOutputsTflite(p.ctx, C.bool(read))
+}
+
+// Return the top k (class index, probability) pairs of every batch item,
+// best first, computed in C++ with a partial selection
+func TopK(p *PredictorData, k int) ([][]int, [][]float32, error) {
+
+	if p.ctx == nil {
+		return nil, nil, errors.New("empty predictor context")
+	}
 
 	batchSize := p.batch
-	if batchSize == 0 {
-		return "", errors.New("null batch")
+	if batchSize == 0 || k <= 0 {
+		return nil, nil, errors.New("null batch or k")
 	}
 
-	predLen := int(C.GetPredLenTflite(p.ctx))
-	if predLen == 0 {
-		return "", errors.New("null predLen")
+	cIndices := make([]C.int, batchSize*k)
+	cScores := make([]C.float, batchSize*k)
+	kk := int(C.GetTopKTflite(p.ctx, C.int(k), C.int(batchSize), &cIndices[0], &cScores[0]))
+	if kk == 0 {
+		return nil, nil, errors.Errorf("no predictions for batch size %d", batchSize)
 	}
 
-	length := batchSize * predLen
+	indices := make([][]int, batchSize)
+	scores := make([][]float32, batchSize)
+	for ii := 0; ii < batchSize; ii++ {
+		indices[ii] = make([]int, kk)
+		scores[ii] = make([]float32, kk)
+		for jj := 0; jj < kk; jj++ {
+			indices[ii][jj] = int(cIndices[ii*kk+jj])
+			scores[ii][jj] = float32(cScores[ii*kk+jj])
+		}
+	}
+
+	return indices, scores, nil
+}
+
+// Return Top-5 predicted label
+func ReadPredictionOutput(p *PredictorData, labelFile string) (string, error) {
+
 	if p.ctx == nil {
 		return "", errors.New("empty predictor context")
 	}
 
-	cPredictions := C.GetPredictionsTflite(p.ctx)
-	if cPredictions == nil {
-		return "", errors.New("empty predictions")
+	// the label table stays resident in the predictor after the first call
+	if p.labelFile != labelFile {
+		cLabelFile := C.CString(labelFile)
+		defer C.free(unsafe.Pointer(cLabelFile))
+		if C.LoadLabelsTflite(p.ctx, cLabelFile) < 0 {
+			return "", errors.Errorf("unable to read label file %s", labelFile)
+		}
+		p.labelFile = labelFile
 	}
 
-	slice := (*[1 << 15]float32)(unsafe.Pointer(cPredictions))[:length:length]
-
-	var labels []string
-	f, err := os.Open(labelFile)
+	indices, _, err := TopK(p, 5)
 	if err != nil {
-		panic(err)
+		return "", err
 	}
 
-	scanner := bufio.NewScanner(f)
-	for scanner.Scan() {
-		line := scanner.Text()
-		labels = append(labels, line)
+	labels := make([]string, len(indices[0]))
+	for ii, index := range indices[0] {
+		labels[ii] = C.GoString(C.GetLabelTflite(p.ctx, C.int(index)))
 	}
 
-	features := make([]dlframework.Features, batchSize)
-	featuresLen := len(slice) / batchSize
+	return strings.Join(labels, "|"), nil
 
-	for ii := 0; ii < batchSize; ii++ {
-		rprobs := make([]*dlframework.Feature, featuresLen)
-		for jj := 0; jj < featuresLen; jj++ {
-			rprobs[jj] = feature.New(
-				feature.ClassificationIndex(int32(jj)),
-				feature.ClassificationLabel(labels[jj]),
-				feature.Probability(slice[ii*featuresLen+jj]),
-			)
+}
+
+// Aggregated timing of one node, or of one op type when Node is -1
+type OpProfile struct {
+	Node    int
+	OpCode  int
+	OpName  string
+	Count   int64
+	TotalMs float64
+	MeanMs  float64
+	P50Ms   float64
+	P99Ms   float64
+}
+
+// Return the operator level profile collected so far (predictor created
+// with profile set), per node or per op type sorted by total time
+func GetOpProfile(p *PredictorData, byOpType bool) []OpProfile {
+
+	if p.ctx == nil {
+		return nil
+	}
+
+	rows := int(C.GetOpProfileTflite(p.ctx, nil, 0, C.bool(byOpType)))
+	if rows == 0 {
+		return nil
+	}
+
+	cProfile := make([]C.OpProfile, rows)
+	rows = int(C.GetOpProfileTflite(p.ctx, &cProfile[0], C.int(rows), C.bool(byOpType)))
+	if rows > len(cProfile) {
+		rows = len(cProfile)
+	}
+
+	profile := make([]OpProfile, rows)
+	for ii := 0; ii < rows; ii++ {
+		row := &cProfile[ii]
+		profile[ii] = OpProfile{
+			Node:    int(row.node_index),
+			OpCode:  int(row.op_code),
+			OpName:  C.GoString(&row.op_name[0]),
+			Count:   int64(row.count),
+			TotalMs: float64(row.total_ms),
+			MeanMs:  float64(row.mean_ms),
+			P50Ms:   float64(row.p50_ms),
+			P99Ms:   float64(row.p99_ms),
+		}
+	}
+
+	return profile
+}
+
+// Write the operator level profile to path as JSON, or CSV when csv is set
+func DumpOpProfile(p *PredictorData, path string, csv bool) error {
+
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
+
+	format := C.PREDICTOR_PROFILE_JSON
+	if csv {
+		format = C.PREDICTOR_PROFILE_CSV
+	}
+
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	if C.DumpOpProfileTflite(p.ctx, cPath, C.int(format)) != 0 {
+		return errors.Errorf("unable to write profile to %s", path)
+	}
+
+	return nil
+}
+
+// Clear the operator level profile
+func ResetOpProfile(p *PredictorData) {
+	C.ResetOpProfileTflite(p.ctx)
+}
+
+// Latency distribution of one request stage (preprocess, quantize, invoke,
+// dequantize, topk)
+type StageStats struct {
+	Stage   string
+	Count   int64
+	TotalMs float64
+	MeanMs  float64
+	P50Ms   float64
+	P90Ms   float64
+	P99Ms   float64
+	MaxMs   float64
+}
+
+// Return the per stage latencies recorded since creation or the last reset
+func GetStats(p *PredictorData) []StageStats {
+
+	if p.ctx == nil {
+		return nil
+	}
+
+	var cStats [C.PREDICTOR_NUM_STAGES]C.StageStats
+	rows := int(C.GetStatsTflite(p.ctx, &cStats[0], C.PREDICTOR_NUM_STAGES))
+
+	stats := make([]StageStats, rows)
+	for ii := 0; ii < rows; ii++ {
+		row := &cStats[ii]
+		stats[ii] = StageStats{
+			Stage:   C.GoString(&row.name[0]),
+			Count:   int64(row.count),
+			TotalMs: float64(row.total_ms),
+			MeanMs:  float64(row.mean_ms),
+			P50Ms:   float64(row.p50_ms),
+			P90Ms:   float64(row.p90_ms),
+			P99Ms:   float64(row.p99_ms),
+			MaxMs:   float64(row.max_ms),
 		}
-		sort.Sort(dlframework.Features(rprobs))
-		features[ii] = rprobs
 	}
 
-	top1 := features[0][0]
-	top2 := features[0][1]
-	top3 := features[0][2]
-	top4 := features[0][3]
-	top5 := features[0][4]
+	return stats
+}
+
+// Accuracy and throughput of an evaluation run
+type EvalStats struct {
+	Images         int64
+	Top1           int64
+	Top5           int64
+	Top1Accuracy   float64
+	Top5Accuracy   float64
+	TotalMs        float64
+	ImagesPerSec   float64
+	InvokeMs       float64
+	PrefetchWaitMs float64
+}
+
+// Run a packed evaluation file (see EvalFileHeader in cbits/predictor.hpp)
+// through the predictor and report top-1 / top-5 accuracy. labelOffset is
+// subtracted from predicted classes, 1 for models with a background class.
+// limit > 0 stops after that many images.
+func Evaluate(p *PredictorData, path string, labelOffset, limit int) (EvalStats, error) {
+
+	if p.ctx == nil {
+		return EvalStats{}, errors.New("empty predictor context")
+	}
+
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+
+	var cStats C.EvalStats
+	if C.EvaluateTflite(p.ctx, cPath, C.int(labelOffset), C.longlong(limit), &cStats) != 0 {
+		return EvalStats{}, fmt.Errorf("failed to evaluate %s", path)
+	}
+
+	return EvalStats{
+		Images:         int64(cStats.images),
+		Top1:           int64(cStats.top1),
+		Top5:           int64(cStats.top5),
+		Top1Accuracy:   float64(cStats.top1_accuracy),
+		Top5Accuracy:   float64(cStats.top5_accuracy),
+		TotalMs:        float64(cStats.total_ms),
+		ImagesPerSec:   float64(cStats.images_per_sec),
+		InvokeMs:       float64(cStats.invoke_ms),
+		PrefetchWaitMs: float64(cStats.prefetch_wait_ms),
+	}, nil
+}
+
+// Counters of a result cache
+type ResultCacheStats struct {
+	Hits          int64
+	Misses        int64
+	Evictions     int64
+	Entries       int64
+	Bytes         int64
+	CapacityBytes int64
+}
+
+func newResultCacheStats(stats *C.ResultCacheStats) ResultCacheStats {
+	return ResultCacheStats{
+		Hits:          int64(stats.hits),
+		Misses:        int64(stats.misses),
+		Evictions:     int64(stats.evictions),
+		Entries:       int64(stats.entries),
+		Bytes:         int64(stats.bytes),
+		CapacityBytes: int64(stats.capacity_bytes),
+	}
+}
+
+// Cache the outputs of repeated inputs, using up to capacityBytes of memory.
+// 0 disables the cache.
+func EnableResultCache(p *PredictorData, capacityBytes int) error {
 
-	top_concatenated := top1.GetClassification().GetLabel() + "|" + top2.GetClassification().GetLabel() + "|" + top3.GetClassification().GetLabel() + "|" + top4.GetClassification().GetLabel() + "|" + top5.GetClassification().GetLabel()
+	if p.ctx == nil {
+		return errors.New("empty predictor context")
+	}
 
-	return top_concatenated, nil
+	if C.EnableResultCacheTflite(p.ctx, C.size_t(capacityBytes)) != 0 {
+		return errors.New("failed to enable the result cache")
+	}
 
+	return nil
+}
+
+// Return the hit, miss and eviction counts of the result cache
+func GetResultCacheStats(p *PredictorData) ResultCacheStats {
+
+	if p.ctx == nil {
+		return ResultCacheStats{}
+	}
+
+	var cStats C.ResultCacheStats
+	C.GetResultCacheStatsTflite(p.ctx, &cStats)
+
+	return newResultCacheStats(&cStats)
+}
+
+// Clear the per stage latencies
+func ResetStats(p *PredictorData) {
+	C.ResetStatsTflite(p.ctx)
 }
 
 // Delete the predictor
 func Close(p *PredictorData) {
 	C.DeleteTflite(p.ctx)
 }
+
+// Batcher Structure definition
+type BatcherData struct {
+	ctx     C.BatcherContext
+	predLen int
+}
+
+// Batcher statistics
+type BatcherStats struct {
+	QueueDepth       int
+	Batches          int64
+	Requests         int64
+	MeanBatchSize    float64
+	MeanQueueDelayUs float64
+	MaxQueueDelayUs  float64
+}
+
+// Create a request batcher in front of the predictor. Single-image requests
+// are coalesced until maxBatch are queued or the oldest has waited maxWaitUs
+// microseconds. The predictor must not be used directly while the batcher
+// is alive.
+func NewBatcher(p *PredictorData, maxBatch, maxWaitUs int) (*BatcherData, error) {
+	if p.ctx == nil {
+		return nil, errors.New("empty predictor context")
+	}
+
+	ctx := C.NewBatcherTflite(p.ctx, C.int(maxBatch), C.int(maxWaitUs))
+	if ctx == nil {
+		return nil, errors.Errorf("invalid batcher configuration: maxBatch %d, maxWaitUs %d", maxBatch, maxWaitUs)
+	}
+
+	return &BatcherData{
+		ctx:     ctx,
+		predLen: int(C.GetPredLenTflite(p.ctx)),
+	}, nil
+}
+
+// Run inference on a single 224x224x3 image through the batcher. Safe to
+// call from many goroutines; blocks until the batch holding the request ran.
+func PredictBatched(b *BatcherData, data []byte, quantize bool) ([]float32, error) {
+
+	if len(data) < 224*224*3*4 {
+		return nil, fmt.Errorf("image data has %d bytes, expected %d", len(data), 224*224*3*4)
+	}
+
+	out := make([]float32, b.predLen)
+	ptr_quantize := (*C.int)(unsafe.Pointer(&data[0]))
+	ptr_float := (*C.float)(unsafe.Pointer(&data[0]))
+	C.PredictBatcherTflite(b.ctx, ptr_quantize, ptr_float, C.bool(quantize), (*C.float)(unsafe.Pointer(&out[0])))
+
+	return out, nil
+}
+
+// Return queue depth, achieved batch size and queueing delay
+func GetBatcherStats(b *BatcherData) BatcherStats {
+	var stats C.BatcherStats
+	C.GetBatcherStatsTflite(b.ctx, &stats)
+	return BatcherStats{
+		QueueDepth:       int(stats.queue_depth),
+		Batches:          int64(stats.batches),
+		Requests:         int64(stats.requests),
+		MeanBatchSize:    float64(stats.mean_batch_size),
+		MeanQueueDelayUs: float64(stats.mean_queue_delay_us),
+		MaxQueueDelayUs:  float64(stats.max_queue_delay_us),
+	}
+}
+
+// Delete the batcher, serving any queued requests first
+func CloseBatcher(b *BatcherData) {
+	C.DeleteBatcherTflite(b.ctx)
+}
+
+// Pool Structure definition
+type PoolData struct {
+	ctx     C.PoolContext
+	batch   int
+	predLen int
+}
+
+// Create a pool of instances interpreters sharing one mmapped model, each
+// running threadsPerInstance (1-8) threads. With pin set, the threads of
+// instance i are restricted to CPUs [i*threadsPerInstance, (i+1)*threadsPerInstance).
+// Under ThreadsShared pin is ignored: each instance runs on the cores it leased.
+func NewPool(model string, instances, threadsPerInstance, batch int, pin, verbose, profile bool) (*PoolData, error) {
+
+	modelFile := model
+	if !com.IsFile(modelFile) {
+		return nil, errors.Errorf("file %s not found", modelFile)
+	}
+
+	cModelFile := C.CString(modelFile)
+	defer C.free(unsafe.Pointer(cModelFile))
+
+	ctx := C.NewTflitePool(
+		cModelFile,
+		C.int(instances),
+		C.int(threadsPerInstance),
+		C.int(batch),
+		C.bool(pin),
+		C.bool(verbose),
+		C.bool(profile),
+	)
+	if ctx == nil {
+		return nil, errors.Errorf("invalid pool configuration: %d instances, %d threads per instance, batch %d", instances, threadsPerInstance, batch)
+	}
+
+	return &PoolData{
+		ctx:     ctx,
+		batch:   batch,
+		predLen: int(C.GetPredLenTflitePool(ctx)),
+	}, nil
+}
+
+// Run inference on a batch of 224x224x3 images on an idle pool instance.
+// Safe to call from many goroutines.
+func PredictPool(pool *PoolData, data []byte, quantize bool) ([]float32, error) {
+
+	expected := pool.batch * 224 * 224 * 3 * 4
+	if len(data) < expected {
+		return nil, fmt.Errorf("image data has %d bytes, expected %d for batch size %d", len(data), expected, pool.batch)
+	}
+
+	out := make([]float32, pool.batch*pool.predLen)
+	ptr_quantize := (*C.int)(unsafe.Pointer(&data[0]))
+	ptr_float := (*C.float)(unsafe.Pointer(&data[0]))
+	C.PredictTflitePool(pool.ctx, ptr_quantize, ptr_float, C.bool(quantize), (*C.float)(unsafe.Pointer(&out[0])))
+
+	return out, nil
+}
+
+// Cache the outputs of repeated inputs in one cache shared by every pool
+// instance. 0 disables the cache.
+func EnablePoolResultCache(pool *PoolData, capacityBytes int) error {
+
+	if C.EnableResultCacheTflitePool(pool.ctx, C.size_t(capacityBytes)) != 0 {
+		return errors.New("failed to enable the pool result cache")
+	}
+
+	return nil
+}
+
+// Return the counters of the cache shared by the pool
+func GetPoolResultCacheStats(pool *PoolData) ResultCacheStats {
+
+	var cStats C.ResultCacheStats
+	C.GetResultCacheStatsTflitePool(pool.ctx, &cStats)
+
+	return newResultCacheStats(&cStats)
+}
+
+// Delete the pool
+func ClosePool(pool *PoolData) {
+	C.DeleteTflitePool(pool.ctx)
+}
+
+// Model manager Structure definition
+type ManagerData struct {
+	ctx     C.ManagerContext
+	mu      sync.Mutex
+	batches map[string]int // batch size per model name
+}
+
+// Memory and load counters of one managed model
+type ModelStats struct {
+	Resident    bool
+	Mapped      bool
+	InUse       int
+	Uses        int64
+	Loads       int64
+	Evictions   int64
+	ArenaBytes  int64
+	ModelBytes  int64
+	LastLoadMs  float64
+	TotalLoadMs float64
+}
+
+// Memory and load counters of a model manager
+type ManagerStats struct {
+	BudgetBytes int64
+	UsedBytes   int64
+	Models      int
+	Resident    int
+	Hits        int64
+	Loads       int64
+	Evictions   int64
+	Unmaps      int64
+}
+
+// Create a model manager that keeps the interpreter arenas and mapped models
+// of every registered model within budgetBytes, evicting the least recently
+// used idle interpreters
+func NewModelManager(budgetBytes int) *ManagerData {
+	return &ManagerData{
+		ctx:     C.NewModelManagerTflite(C.size_t(budgetBytes)),
+		batches: make(map[string]int),
+	}
+}
+
+// Register a model under name; it is loaded on first use
+func AddModel(m *ManagerData, name, model string, mode, batch int) error {
+
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+	cModel := C.CString(model)
+	defer C.free(unsafe.Pointer(cModel))
+
+	if C.AddModelTflite(m.ctx, cName, cModel, C.int(batch), C.int(mode)) != 0 {
+		return errors.Errorf("unable to add model %s (%s)", name, model)
+	}
+
+	m.mu.Lock()
+	m.batches[name] = batch
+	m.mu.Unlock()
+
+	return nil
+}
+
+// Return the predictor of a managed model, reloading it if it was evicted.
+// It stays valid until ReleaseModel; do not Close it. Only one goroutine
+// holds a model at a time, others block in AcquireModel until it is
+// released.
+func AcquireModel(m *ManagerData, name string) (*PredictorData, error) {
+
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+
+	ctx, err := C.AcquireModelTflite(m.ctx, cName)
+	if ctx == nil {
+		if err == syscall.ENOENT {
+			return nil, errors.Errorf("unknown model %s", name)
+		}
+		return nil, errors.Wrapf(err, "unable to load model %s", name)
+	}
+
+	m.mu.Lock()
+	batch := m.batches[name]
+	m.mu.Unlock()
+
+	return &PredictorData{
+		ctx:   ctx,
+		batch: batch,
+	}, nil
+}
+
+// Hand a predictor obtained from AcquireModel back to the manager
+func ReleaseModel(m *ManagerData, name string) {
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+	C.ReleaseModelTflite(m.ctx, cName)
+}
+
+// Return the memory and load counters of a managed model
+func GetModelStats(m *ManagerData, name string) (ModelStats, error) {
+
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+
+	var cStats C.ModelStats
+	if C.GetModelStatsTflite(m.ctx, cName, &cStats) != 0 {
+		return ModelStats{}, errors.Errorf("unknown model %s", name)
+	}
+
+	return ModelStats{
+		Resident:    bool(cStats.resident),
+		Mapped:      bool(cStats.mapped),
+		InUse:       int(cStats.in_use),
+		Uses:        int64(cStats.uses),
+		Loads:       int64(cStats.loads),
+		Evictions:   int64(cStats.evictions),
+		ArenaBytes:  int64(cStats.arena_bytes),
+		ModelBytes:  int64(cStats.model_bytes),
+		LastLoadMs:  float64(cStats.last_load_ms),
+		TotalLoadMs: float64(cStats.total_load_ms),
+	}, nil
+}
+
+// Return the memory and load counters of the manager
+func GetManagerStats(m *ManagerData) ManagerStats {
+
+	var cStats C.ManagerStats
+	C.GetManagerStatsTflite(m.ctx, &cStats)
+
+	return ManagerStats{
+		BudgetBytes: int64(cStats.budget_bytes),
+		UsedBytes:   int64(cStats.used_bytes),
+		Models:      int(cStats.models),
+		Resident:    int(cStats.resident),
+		Hits:        int64(cStats.hits),
+		Loads:       int64(cStats.loads),
+		Evictions:   int64(cStats.evictions),
+		Unmaps:      int64(cStats.unmaps),
+	}
+}
+
+// Delete the manager and every predictor it holds
+func CloseModelManager(m *ManagerData) {
+	C.DeleteModelManagerTflite(m.ctx)
+}
+
+// Pipeline Structure definition
+type PipelineData struct {
+	ctx     C.PipelineContext
+	batch   int
+	predLen int
+	topK    int
+
+	mu      sync.Mutex
+	pending map[unsafe.Pointer]*pipelineRequest
+}
+
+// C side buffers of a request in flight; Go memory cannot be retained by C
+// past the call that received it
+type pipelineRequest struct {
+	input   unsafe.Pointer
+	output  unsafe.Pointer
+	indices unsafe.Pointer
+	scores  unsafe.Pointer
+}
+
+func (r *pipelineRequest) free() {
+	C.free(r.input)
+	C.free(r.output)
+	C.free(r.indices)
+	C.free(r.scores)
+}
+
+// Result of a pipelined request
+type PipelineResult struct {
+	ID      int64
+	Output  []float32 // batch * predLen scores
+	Indices []int     // batch * topK classes, best first, when topK > 0
+	Scores  []float32
+}
+
+// Create an asynchronous pipeline on a predictor. Preprocessing, inference
+// and output conversion of successive requests overlap; at most depth
+// requests are in flight. The predictor must not be used directly until the
+// pipeline is closed.
+func NewPipeline(p *PredictorData, depth, topK int) (*PipelineData, error) {
+
+	if p.ctx == nil {
+		return nil, errors.New("empty predictor context")
+	}
+
+	ctx := C.NewPipelineTflite(p.ctx, C.int(depth), C.int(topK))
+	if ctx == nil {
+		return nil, errors.Errorf("invalid pipeline configuration: depth %d, topK %d", depth, topK)
+	}
+
+	predLen := int(C.GetPredLenTflite(p.ctx))
+	if topK > predLen {
+		topK = predLen
+	}
+
+	return &PipelineData{
+		ctx:     ctx,
+		batch:   p.batch,
+		predLen: predLen,
+		topK:    topK,
+		pending: make(map[unsafe.Pointer]*pipelineRequest),
+	}, nil
+}
+
+// Queue a batch of images of the given geometry and return the request ID.
+// Blocks while depth requests are in flight; results are collected with Poll.
+func Submit(pl *PipelineData, data []byte, quantize bool, geometry ImageGeometry) (int64, error) {
+
+	if geometry.Height <= 0 || geometry.Width <= 0 || geometry.Channels <= 0 {
+		return -1, fmt.Errorf("invalid image geometry %dx%dx%d", geometry.Height, geometry.Width, geometry.Channels)
+	}
+	if geometry.Layout != LayoutHWC && geometry.Layout != LayoutCHW {
+		return -1, fmt.Errorf("invalid image layout %d", geometry.Layout)
+	}
+
+	// both int and float elements are 4 bytes wide
+	expected := pl.batch * geometry.Height * geometry.Width * geometry.Channels * 4
+	if len(data) < expected {
+		return -1, fmt.Errorf("image data has %d bytes, expected %d for batch size %d", len(data), expected, pl.batch)
+	}
+
+	cGeometry := C.ImageGeometry{
+		height:   C.int(geometry.Height),
+		width:    C.int(geometry.Width),
+		channels: C.int(geometry.Channels),
+		layout:   C.int(geometry.Layout),
+		bgr:      C.bool(geometry.BGR),
+	}
+
+	request := &pipelineRequest{
+		input:  C.malloc(C.size_t(expected)),
+		output: C.malloc(C.size_t(pl.batch * pl.predLen * 4)),
+	}
+	copy(cBytes(request.input, expected), data)
+	var cIndices *C.int
+	var cScores *C.float
+	if pl.topK > 0 {
+		request.indices = C.malloc(C.size_t(pl.batch * pl.topK * 4))
+		request.scores = C.malloc(C.size_t(pl.batch * pl.topK * 4))
+		cIndices = (*C.int)(request.indices)
+		cScores = (*C.float)(request.scores)
+	}
+
+	// the input buffer doubles as the key handed back by PollTflite
+	pl.mu.Lock()
+	pl.pending[request.input] = request
+	pl.mu.Unlock()
+
+	id := C.SubmitTflite(pl.ctx, (*C.int)(request.input), (*C.float)(request.input), C.bool(quantize),
+		&cGeometry, (*C.float)(request.output), cIndices, cScores, nil, request.input)
+	if id < 0 {
+		pl.mu.Lock()
+		delete(pl.pending, request.input)
+		pl.mu.Unlock()
+		request.free()
+		return -1, errors.New("unable to submit request")
+	}
+
+	return int64(id), nil
+}
+
+// Return the next completed request, or false when none is ready. With wait
+// set, blocks until a request completes or none is pending.
+func Poll(pl *PipelineData, wait bool) (*PipelineResult, bool) {
+
+	var id C.longlong
+	var userData unsafe.Pointer
+	if C.PollTflite(pl.ctx, &id, &userData, C.bool(wait)) == 0 {
+		return nil, false
+	}
+
+	pl.mu.Lock()
+	request := pl.pending[userData]
+	delete(pl.pending, userData)
+	pl.mu.Unlock()
+
+	length := pl.batch * pl.predLen
+	result := &PipelineResult{
+		ID:     int64(id),
+		Output: make([]float32, length),
+	}
+	copy(result.Output, cFloats(request.output, length))
+	if pl.topK > 0 {
+		length = pl.batch * pl.topK
+		result.Indices = make([]int, length)
+		for ii, index := range cInts(request.indices, length) {
+			result.Indices[ii] = int(index)
+		}
+		result.Scores = make([]float32, length)
+		copy(result.Scores, cFloats(request.scores, length))
+	}
+
+	request.free()
+
+	return result, true
+}
+
+// Delete the pipeline, serving any submitted requests first. Results not
+// collected with Poll are dropped.
+func ClosePipeline(pl *PipelineData) {
+	C.DeletePipelineTflite(pl.ctx)
+	for _, request := range pl.pending {
+		request.free()
+	}
+	pl.pending = nil
+}
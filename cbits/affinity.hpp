@@ -0,0 +1,63 @@
+#ifndef __AFFINITY_HPP__
+#define __AFFINITY_HPP__
+
+#include <vector>
+
+// Number of online CPUs
+int OnlineCpus();
+
+// One usable CPU as described under /sys/devices/system/cpu
+struct CpuInfo {
+  int cpu;
+  int package;       // physical_package_id
+  int core;          // core_id within the package
+  long max_freq_khz; // cpufreq/cpuinfo_max_freq, 0 when unknown
+};
+
+// The CPUs this process may run on, probed once, in order of preference:
+// highest maximum frequency first (the big cores of a big.LITTLE SoC), and
+// the first hardware thread of every core before its siblings
+const std::vector<CpuInfo>& CpuTopology();
+
+// Distinct (package, core) pairs among the usable CPUs
+int PhysicalCores();
+
+// `count` consecutive CPUs of CpuTopology() starting at `first`, wrapped
+// around
+std::vector<int> CpuRange(int first, int count);
+
+// Share of the machine granted to one predictor under
+// PREDICTOR_THREADS_SHARED: a thread count and the CPUs to run them on
+struct CpuLease {
+  int threads = 0;
+  std::vector<int> cpus;
+};
+
+// Process-wide thread policy (PREDICTOR_THREADS_DEFAULT / _SHARED)
+int ThreadPolicy();
+
+// Grants up to `requested` threads without taking the total of all leases
+// beyond PhysicalCores(), placed on the least loaded, fastest physical
+// cores. ReturnCpus hands them back. Every lease gets at least one thread,
+// so the total does exceed PhysicalCores() once more leases than cores are
+// held (ThreadStats.oversubscribed_threads).
+CpuLease LeaseCpus(int requested);
+void ReturnCpus(const CpuLease &lease);
+
+// Restricts the calling thread to `cpus`. Threads it spawns afterwards
+// inherit the mask, which is how interpreter worker threads get pinned.
+bool PinCurrentThread(const std::vector<int> &cpus);
+
+// Pins the calling thread for the lifetime of the object and restores the
+// previous mask on destruction. An empty cpu list is a no-op.
+class ScopedAffinity {
+  public:
+    explicit ScopedAffinity(const std::vector<int> &cpus);
+    ~ScopedAffinity();
+
+  private:
+    std::vector<int> previous_;
+    bool pinned_ = false;
+};
+
+#endif  // __AFFINITY_HPP__
@@ -0,0 +1,44 @@
+#ifndef __OP_STATS_HPP__
+#define __OP_STATS_HPP__
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "predictor.hpp"
+
+/*
+  OpStats aggregates per-operator timings over many invokes. Each node keeps
+  its count and total time plus a ring of its most recent samples, from
+  which the percentiles are computed on demand.
+*/
+class OpStats {
+  public:
+    void Record(int node_index, int op_code, const char* op_name, double ms);
+    void Reset();
+
+    // Writes up to max rows (per node, or per op type when by_op_type) and
+    // returns the number of rows available
+    int Export(OpProfile* out, int max, bool by_op_type) const;
+
+    // format: PREDICTOR_PROFILE_JSON or PREDICTOR_PROFILE_CSV
+    bool Dump(const std::string &path, int format) const;
+
+  private:
+    static const int kSamples = 1024;
+
+    struct Entry {
+      int op_code = 0;
+      std::string op_name;
+      long long count = 0;
+      double total_ms = 0;
+      std::vector<float> samples; // ring of the last kSamples timings
+    };
+
+    static void Summarize(int node_index, const Entry &entry, OpProfile* out);
+    std::vector<OpProfile> Rows(bool by_op_type) const;
+
+    std::map<int, Entry> nodes_;
+};
+
+#endif  // __OP_STATS_HPP__
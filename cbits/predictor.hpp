@@ -7,17 +7,281 @@ extern "C" {
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef void *PredictorContext;
 
+// Predictor modes besides 1 - 8 (builtin CPU kernels with that many threads)
+#define PREDICTOR_MODE_GPU 9
+#define PREDICTOR_MODE_NNAPI 10
+#define PREDICTOR_MODE_XNNPACK 11 // 11 - 18: XNNPACK delegate with 1 - 8 threads
+// Benchmarks the CPU modes on the model at load time and keeps the fastest.
+// The choice is cached in $TFLITE_PREDICTOR_MODE_CACHE (default
+// tflite-predictor-modes in $XDG_CACHE_HOME or ~/.cache), keyed by model
+// hash, CPU and batch size.
+#define PREDICTOR_MODE_AUTO 19
+
+// Thread policies, see SetThreadPolicyTflite
+#define PREDICTOR_THREADS_DEFAULT 0 // every predictor runs the threads of its mode, unpinned
+#define PREDICTOR_THREADS_SHARED 1  // threads leased from one budget of physical cores, pinned
+
+#define PREDICTOR_MAX_DIMS 8
+
+// Describes an interpreter tensor. `data` points into the interpreter's own
+// memory and stays valid until the predictor is resized or deleted.
+typedef struct {
+  const char *name;
+  void *data;
+  int type; // TfLiteType: 1 float32, 2 int32, 3 uint8, 9 int8
+  int num_dims;
+  int dims[PREDICTOR_MAX_DIMS];
+  size_t bytes;
+  float scale;
+  int zero_point;
+} PredictorTensorInfo;
+
+#define PREDICTOR_MAX_OUTPUTS 8
+
+// Where PredictIntoTflite wrote each output tensor in the caller's buffer.
+// Only the first PREDICTOR_MAX_OUTPUTS outputs are described.
+typedef struct {
+  int num_outputs;
+  size_t total_len;                     // floats needed for every output
+  size_t offset[PREDICTOR_MAX_OUTPUTS]; // first float of each output
+  size_t len[PREDICTOR_MAX_OUTPUTS];
+  int num_dims[PREDICTOR_MAX_OUTPUTS];
+  int dims[PREDICTOR_MAX_OUTPUTS][PREDICTOR_MAX_DIMS];
+} PredictResult;
+
+#define PREDICTOR_LAYOUT_HWC 0
+#define PREDICTOR_LAYOUT_CHW 1
+
+// Geometry of a source image handed to PredictImageTflite
+typedef struct {
+  int height;
+  int width;
+  int channels;
+  int layout; // PREDICTOR_LAYOUT_HWC or PREDICTOR_LAYOUT_CHW
+  bool bgr;   // channels are stored BGR rather than RGB
+} ImageGeometry;
+
+#define PREDICTOR_PROFILE_JSON 0
+#define PREDICTOR_PROFILE_CSV 1
+
+// Aggregated timing of one node (or, with node_index -1, one op type) over
+// every profiled invoke. Percentiles cover the most recent 1024 invokes.
+typedef struct {
+  int node_index;
+  int op_code;
+  char op_name[32];
+  long long count;
+  double total_ms;
+  double mean_ms;
+  double p50_ms;
+  double p99_ms;
+} OpProfile;
+
+// Request stages timed by every predictor
+#define PREDICTOR_STAGE_PREPROCESS 0 // resize / layout conversion of one image
+#define PREDICTOR_STAGE_QUANTIZE 1   // direct copy of one image into the input tensor
+#define PREDICTOR_STAGE_INVOKE 2
+#define PREDICTOR_STAGE_DEQUANTIZE 3 // reading every output tensor as float
+#define PREDICTOR_STAGE_TOPK 4
+#define PREDICTOR_NUM_STAGES 5
+
+// Latency distribution of one stage since creation or the last reset.
+// Percentiles are accurate to ~3%.
+typedef struct {
+  int stage;
+  char name[16];
+  long long count;
+  double total_ms;
+  double mean_ms;
+  double p50_ms;
+  double p90_ms;
+  double p99_ms;
+  double max_ms;
+} StageStats;
+
+// Cold start breakdown of one predictor
+typedef struct {
+  int mode;               // mode in use, PREDICTOR_MODE_AUTO resolved
+  double probe_ms;        // resolving PREDICTOR_MODE_AUTO (hashing, and benchmarking on a cache miss)
+  bool model_cached;      // the mmapped model was shared with another predictor
+  double model_ms;        // model lookup / mmap
+  double interpreter_ms;  // interpreter build (and mode probe), delegate and tensor allocation
+  double first_invoke_ms; // first invoke of the session, warm-up or not
+  double warm_invoke_ms;  // second invoke
+  int warmup_invokes;     // invokes run by WarmupTflite
+} StartupStats;
+
+// Counters of the result cache shared by a predictor (or pool)
+typedef struct {
+  long long hits;
+  long long misses;
+  long long evictions;
+  long long entries;
+  size_t bytes;          // held by the cached entries
+  size_t capacity_bytes;
+} ResultCacheStats;
+
+// Packed evaluation set, see EvaluateTflite: this 64 byte header, then count
+// HWC RGB images of height x width x channels elements, then count int32
+// labels. Everything is little endian.
+#define PREDICTOR_EVAL_MAGIC "TFLEVAL"
+#define PREDICTOR_EVAL_VERSION 1
+#define PREDICTOR_EVAL_UINT8 0
+#define PREDICTOR_EVAL_FLOAT32 1
+
+typedef struct {
+  char magic[8];     // PREDICTOR_EVAL_MAGIC, NUL terminated
+  int32_t version;   // PREDICTOR_EVAL_VERSION
+  int32_t count;
+  int32_t height;
+  int32_t width;
+  int32_t channels;
+  int32_t dtype;     // PREDICTOR_EVAL_UINT8 or PREDICTOR_EVAL_FLOAT32
+  char reserved[32];
+} EvalFileHeader;
+
+typedef struct {
+  long long images;
+  long long top1;           // images whose label is the best class
+  long long top5;           // images whose label is among the best 5
+  double top1_accuracy;
+  double top5_accuracy;
+  double total_ms;
+  double images_per_sec;
+  double invoke_ms;         // time spent in Invoke
+  double prefetch_wait_ms;  // time Invoke waited on the next batch
+} EvalStats;
+
+typedef void *ManagerContext;
+
+// One model of a model manager
+typedef struct {
+  bool resident;          // interpreter built
+  bool mapped;            // model file mapped
+  int in_use;             // 1 while acquired and not yet released
+  long long uses;         // acquisitions
+  long long loads;        // interpreter builds, the first one included
+  long long evictions;    // interpreter deletions to stay within budget
+  size_t arena_bytes;     // tensor arenas of the last interpreter built
+  size_t model_bytes;     // mapped model, 0 when unmapped
+  double last_load_ms;    // model mapping (if needed), interpreter build and warm-up
+  double total_load_ms;
+} ModelStats;
+
+typedef struct {
+  size_t budget_bytes;
+  size_t used_bytes;      // arenas of resident interpreters and mapped models
+  int models;
+  int resident;           // interpreters built
+  long long hits;         // acquisitions served by a resident interpreter
+  long long loads;
+  long long evictions;    // interpreters deleted
+  long long unmaps;       // model mappings dropped
+} ManagerStats;
+
+typedef struct {
+  int policy;             // PREDICTOR_THREADS_DEFAULT or PREDICTOR_THREADS_SHARED
+  int online_cpus;
+  int usable_cpus;        // in the process affinity mask
+  int physical_cores;     // among the usable CPUs, the thread budget of PREDICTOR_THREADS_SHARED
+  int leased_threads;     // held by live predictors under PREDICTOR_THREADS_SHARED
+  int oversubscribed_threads; // leased beyond physical_cores, see SetThreadPolicyTflite
+  long max_freq_khz;      // fastest usable core, 0 when unknown
+} ThreadStats;
+
+typedef void *BatcherContext;
+
+typedef void *PoolContext;
+
+typedef void *PipelineContext;
+
+// Invoked on the pipeline's output thread once request `id` has completed
+typedef void (*PipelineCallback)(void *user_data, long long id);
+
+typedef struct {
+  int queue_depth;            // requests waiting to be batched
+  long long batches;          // batched invokes run so far
+  long long requests;         // requests served so far
+  double mean_batch_size;     // requests / batches
+  double mean_queue_delay_us; // time from submit to dispatch
+  double max_queue_delay_us;
+} BatcherStats;
+
 PredictorContext NewTflite(char *model_file, int batch, int mode, bool verbose, bool profile);
 
+// NewTflite followed by warmup_invokes inferences on zeroed input before it
+// returns (see WarmupTflite), so the predictor handed out is already warm
+PredictorContext NewTfliteWarm(char *model_file, int batch, int mode, bool verbose, bool profile, int warmup_invokes);
+
 void SetModeTflite(int mode);
 
+// Maps a model into the process-wide cache and keeps it there until
+// UnloadModelTflite, so later NewTflite calls on the same file (and
+// unchanged mtime) skip the load. Returns 0 on success.
+int PreloadModelTflite(char *model_file);
+
+void UnloadModelTflite(char *model_file);
+
+// Runs invokes inferences on zeroed input right away, so that the first real
+// request does not pay the one-off costs
+void WarmupTflite(PredictorContext pred, int invokes);
+
+void GetStartupStatsTflite(PredictorContext pred, StartupStats* stats);
+
 void InitTflite();
 
+// Sets the thread policy of predictors created afterwards. Under
+// PREDICTOR_THREADS_SHARED the threads of all predictors (pool instances
+// included) together stay within the physical cores: each predictor gets
+// min(threads of its mode, cores not yet leased), at least one, pinned to
+// the least loaded of the fastest cores, and gives them back on deletion.
+// The one thread is granted even once every core is leased, so with more
+// predictors than cores the budget is over-subscribed: the extra threads
+// share the least loaded cores and are reported in oversubscribed_threads.
+void SetThreadPolicyTflite(int policy);
+
+void GetThreadStatsTflite(ThreadStats* stats);
+
+// Pins the predictor's invokes (and the interpreter threads it starts) to
+// cpus, or unpins it when n is 0. Returns 0 on success.
+int SetAffinityTflite(PredictorContext pred, int* cpus, int n);
+
 void PredictTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize);
 
+// Like PredictTflite, but each of the batch images has the given geometry
+// instead of 224 X 224 X 3 RGB. Images matching the model input are copied
+// as is, anything else is resized on the fly.
+void PredictImageTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry* geometry);
+
+// PredictImageTflite and output conversion in one call: every output tensor
+// is dequantized straight into out, back to back, and described in result.
+// When out_len is below result->total_len nothing is run and -1 is returned,
+// so the caller can grow out and retry. batch is the number of images the
+// caller passes, -1 is returned without reading them when it is not the
+// predictor's batch size. Returns 0 on success.
+int PredictIntoTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize,
+                      const ImageGeometry* geometry, int batch, float* out, size_t out_len, PredictResult* result);
+
+// Batch images with one byte per element, e.g. decoded JPEG pixels. For
+// uint8 / int8 models the bytes are taken as the model's uint8 quantized
+// input (int8 models get them offset by -128) and resized in the integer
+// domain, without float conversion; float models get the byte values.
+void PredictUInt8Tflite(PredictorContext pred, uint8_t* images, const ImageGeometry* geometry);
+
+// Per-channel normalization of float32 model inputs, fused into the resize:
+// input = (pixel - mean[c]) * scale[c] for channel c < channels (1 - 4,
+// repeated across wider inputs). NULL mean and scale restore the identity.
+// Quantized inputs are never normalized, they are taken as the model's
+// uint8 quantized domain. Returns 0 on success.
+int SetNormalizationTflite(PredictorContext pred, const float* mean, const float* scale, int channels);
+
+// Outputs are dequantized lazily: only on the first call to
+// GetPredictionsTflite / GetOutputTflite after an inference, so callers
+// taking GetTopKTflite alone never convert the full output
 float* GetPredictionsTflite(PredictorContext pred);
 
 void DeleteTflite(PredictorContext pred);
@@ -30,6 +294,161 @@ int GetChannelsTflite(PredictorContext pred);
 
 int GetPredLenTflite(PredictorContext pred);
 
+// Zero-copy input: callers write the (already preprocessed) input straight
+// into the buffer returned by GetInputTensorTflite, then call InvokeTflite.
+int GetInputTensorTflite(PredictorContext pred, PredictorTensorInfo* info);
+
+// Generic tensor binding for models with several inputs / outputs. Indices
+// follow the model's input and output order; names map to indices through
+// FindInputTflite / FindOutputTflite (-1 when absent).
+int GetInputCountTflite(PredictorContext pred);
+
+int GetInputTensorAtTflite(PredictorContext pred, int index, PredictorTensorInfo* info);
+
+int FindInputTflite(PredictorContext pred, char* name);
+
+int FindOutputTflite(PredictorContext pred, char* name);
+
+// Resizes input `index` to dims; tensors are reallocated only when the shape
+// changes. Invalidates the data pointers of every tensor. Returns 0 on success.
+int ResizeInputTflite(PredictorContext pred, int index, int* dims, int num_dims);
+
+// With read_outputs unset, InvokeTflite leaves the outputs in their tensors
+// (see GetOutputTensorTflite) instead of converting them all to float
+void SetReadOutputsTflite(PredictorContext pred, bool read_outputs);
+
+void InvokeTflite(PredictorContext pred);
+
+// All output tensors, dequantized to float. Buffers are allocated once per
+// session and overwritten by every inference.
+int GetOutputCountTflite(PredictorContext pred);
+
+int GetOutputLenTflite(PredictorContext pred, int index);
+
+float* GetOutputTflite(PredictorContext pred, int index);
+
+int GetOutputTensorTflite(PredictorContext pred, int index, PredictorTensorInfo* info);
+
+// Makes output `index` land in a caller owned buffer of GetOutputLenTflite
+// floats (NULL reverts to the predictor's own buffer)
+void SetOutputBufferTflite(PredictorContext pred, int index, float* buffer);
+
+// Writes the top k (index, score) pairs of each batch item of output 0, best
+// first, into indices/scores (batch * k entries). Returns k clamped to the
+// prediction length, or 0 without writing anything when batch (the caller's
+// capacity in batch items) is below the predictor's batch size.
+int GetTopKTflite(PredictorContext pred, int k, int batch, int* indices, float* scores);
+
+// Loads the label file once; returns the number of labels or -1
+int LoadLabelsTflite(PredictorContext pred, char* label_file);
+
+const char* GetLabelTflite(PredictorContext pred, int index);
+
+// Operator level profile, collected when the predictor was created with
+// profile set. Writes up to max rows into out (per node, or per op type
+// sorted by total time) and returns the number of rows available.
+int GetOpProfileTflite(PredictorContext pred, OpProfile* out, int max, bool by_op_type);
+
+// Writes the per node and per op type profile to path; returns 0 on success
+int DumpOpProfileTflite(PredictorContext pred, char* path, int format);
+
+void ResetOpProfileTflite(PredictorContext pred);
+
+// Caches the outputs of up to capacity_bytes worth of inferences, keyed by a
+// hash of the input tensors and the model, so that repeated inputs skip
+// Invoke. 0 disables the cache. Any previous cache is dropped. Returns 0 on
+// success.
+int EnableResultCacheTflite(PredictorContext pred, size_t capacity_bytes);
+
+void GetResultCacheStatsTflite(PredictorContext pred, ResultCacheStats* stats);
+
+// Streams a packed evaluation file (EvalFileHeader) through the predictor,
+// batch_ images per Invoke, preparing the next batch while the current one
+// runs. A prediction is correct when class index - label_offset equals the
+// label (label_offset is 1 for models with a background class). limit > 0
+// stops after that many images. Returns 0, or -1 when the file is invalid.
+int EvaluateTflite(PredictorContext pred, char* path, int label_offset, long long limit, EvalStats* stats);
+
+// Per stage latency histograms, always collected. Writes up to max stages
+// into out and returns PREDICTOR_NUM_STAGES.
+int GetStatsTflite(PredictorContext pred, StageStats* out, int max);
+
+void ResetStatsTflite(PredictorContext pred);
+
+BatcherContext NewBatcherTflite(PredictorContext pred, int max_batch, int max_wait_us);
+
+void PredictBatcherTflite(BatcherContext b, int* inputData_quantize, float* inputData_float, bool quantize, float* out);
+
+void GetBatcherStatsTflite(BatcherContext b, BatcherStats* stats);
+
+void DeleteBatcherTflite(BatcherContext b);
+
+// pin_threads restricts instance i to CPUs [i * threads_per_instance,
+// (i + 1) * threads_per_instance). It is ignored under
+// PREDICTOR_THREADS_SHARED, where every instance is pinned to its lease.
+PoolContext NewTflitePool(char *model_file, int n_instances, int threads_per_instance, int batch, bool pin_threads, bool verbose, bool profile);
+
+void PredictTflitePool(PoolContext p, int* inputData_quantize, float* inputData_float, bool quantize, float* out);
+
+int GetPredLenTflitePool(PoolContext p);
+
+// One result cache shared by every instance of the pool, see
+// EnableResultCacheTflite. Call before serving requests.
+int EnableResultCacheTflitePool(PoolContext p, size_t capacity_bytes);
+
+void GetResultCacheStatsTflitePool(PoolContext p, ResultCacheStats* stats);
+
+void DeleteTflitePool(PoolContext p);
+
+// Serves many models within budget_bytes of interpreter arenas and mapped
+// models. Interpreters are built on first use and the least recently used
+// idle ones are deleted when the budget is exceeded, keeping their mapped
+// model so that a reload only rebuilds the interpreter (mappings go too when
+// that is not enough).
+ManagerContext NewModelManagerTflite(size_t budget_bytes);
+
+// Registers model_file under name; nothing is loaded yet. Returns 0 on
+// success, -1 when the file is missing or the name is taken.
+int AddModelTflite(ManagerContext m, char* name, char* model_file, int batch, int mode);
+
+// Returns the predictor of model name, (re)loading it if it was evicted. It
+// is not evicted, and stays valid, until the matching ReleaseModelTflite.
+// One caller at a time per model: a second acquirer blocks until the
+// release. Never delete it. Returns NULL with errno ENOENT for an unknown
+// name and EIO when the model could not be (re)loaded.
+PredictorContext AcquireModelTflite(ManagerContext m, char* name);
+
+void ReleaseModelTflite(ManagerContext m, char* name);
+
+int GetModelStatsTflite(ManagerContext m, char* name, ModelStats* stats);
+
+void GetManagerStatsTflite(ManagerContext m, ManagerStats* stats);
+
+void DeleteModelManagerTflite(ManagerContext m);
+
+// Asynchronous inference: preprocessing, Invoke and output conversion of
+// successive requests overlap on three threads. The pipeline takes over the
+// predictor until it is deleted. depth bounds the requests in flight; with
+// topk > 0 the top classes of every batch item are computed as well.
+PipelineContext NewPipelineTflite(PredictorContext pred, int depth, int topk);
+
+// Queues batch images of the given geometry (NULL for 224 X 224 X 3 RGB) and
+// returns the request id, blocking while depth requests are in flight. The
+// input and result buffers must stay valid until completion. out receives
+// batch * pred_len floats, topk_indices/topk_scores batch * topk entries (any
+// may be NULL). Completion is reported through callback, or through
+// PollTflite when callback is NULL.
+long long SubmitTflite(PipelineContext pl, int* inputData_quantize, float* inputData_float, bool quantize,
+                       const ImageGeometry* geometry, float* out, int* topk_indices, float* topk_scores,
+                       PipelineCallback callback, void* user_data);
+
+// Returns 1 and the id / user_data of a completed request, or 0 when none is
+// ready. With wait set, blocks until a request completes or none is pending.
+int PollTflite(PipelineContext pl, long long* id, void** user_data, bool wait);
+
+// Serves every submitted request, then stops the pipeline
+void DeletePipelineTflite(PipelineContext pl);
+
 void SetInputTflite_float(float* out, float* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels);
 
 void SetInputTflite_quantize_8_unsigned(uint8_t* out, int* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels);
@@ -0,0 +1,169 @@
+#ifndef __PREDICTOR_IMPL_HPP__
+#define __PREDICTOR_IMPL_HPP__
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tensorflow/lite/interpreter.h"
+#include "tensorflow/lite/model.h"
+#include "tensorflow/lite/profiling/profiler.h"
+
+#include "affinity.hpp"
+#include "op_stats.hpp"
+#include "predictor.hpp"
+#include "preprocess.hpp"
+#include "result_cache.hpp"
+#include "stage_stats.hpp"
+
+#define LOG(x) std::cerr
+
+// A model from the process-wide cache (model_cache.cpp)
+struct ModelLoad {
+  std::shared_ptr<tflite::FlatBufferModel> net;
+  bool cached = false; // already mapped for another predictor
+  double ms = 0;
+};
+
+// Null net when the file cannot be mapped; pin keeps it mapped until
+// UnloadModelTflite
+ModelLoad LookupModel(const std::string &model_file, bool pin);
+// Exits the process when the file cannot be mapped
+ModelLoad LoadModelCached(const std::string &model_file);
+std::shared_ptr<tflite::FlatBufferModel> LoadModel(const std::string &model_file);
+
+// Resolves PREDICTOR_MODE_AUTO to the fastest CPU mode for this model and
+// machine (mode_select.cpp)
+int SelectMode(const std::shared_ptr<tflite::FlatBufferModel> &net, int batch, bool verbose);
+
+// XXH64 of the model bytes
+uint64_t ModelHash(const tflite::FlatBufferModel &net);
+
+// 224 X 224 X 3 RGB HWC, what PredictTflite has always assumed
+extern const ImageGeometry kDefaultGeometry;
+
+// CPU backend context shared under PREDICTOR_THREADS_SHARED, see predictor.cpp
+struct SharedBackend;
+
+/*
+  Predictor class takes in model file (converted into .tflite from the original .pb file
+  using tflite_convert CLI tool), batch size and device mode for inference
+*/
+class Predictor {
+  public:
+    Predictor(const std::string &model_file, int batch, int mode, bool verbose, bool profile);
+    Predictor(std::shared_ptr<tflite::FlatBufferModel> net, int batch, int mode, bool verbose, bool profile);
+    ~Predictor();
+    void Predict(int* inputData_quantize, float* inputData_float, bool quantize,
+                 const ImageGeometry &geometry = kDefaultGeometry);
+
+    // Building blocks of Predict, also used by the request batcher.
+    // FillInput copies (resizing if needed) one image into batch slot `slot`.
+    void FillInput(int slot, int* inputData_quantize, float* inputData_float, bool quantize,
+                   const ImageGeometry &geometry = kDefaultGeometry);
+    void FillInputBuffer(void* input, int slot, int* inputData_quantize, float* inputData_float, bool quantize,
+                         const ImageGeometry &geometry = kDefaultGeometry);
+    // One byte per element: quantized models take the integer path, float
+    // models get the byte values as float
+    void FillInputUInt8(int slot, const uint8_t* image, const ImageGeometry &geometry);
+    void Invoke();
+    // interpreter->Invoke() pinned to cpus_ and, on the shared CPU backend
+    // context, holding its lock. Skips the result cache and statistics.
+    bool InvokeInterpreter();
+    void ReadOutput();
+    // Marks the float outputs stale instead of converting them: they are
+    // converted on first access (SyncOutputs), so callers that only take
+    // TopK never dequantize the full output. Converts right away when a
+    // caller buffer is installed.
+    void DeferOutputs();
+    void SyncOutputs();
+    void Warmup(int invokes);
+    void SetResultCache(std::shared_ptr<ResultCache> cache, uint64_t model_hash);
+    // Changes the number of images per Invoke. Returns false when the backend
+    // cannot be resized (GPU / NNAPI), in which case batch_ is left unchanged.
+    bool SetBatch(int batch);
+    bool ResizeInput(int index, const std::vector<int> &dims);
+    // Memory held by the interpreter's tensor arenas and dynamic tensors
+    size_t ArenaBytes();
+    // Pins invokes to `cpus` (empty: unpinned) and restarts the builtin
+    // kernels' worker threads under the new mask
+    void SetAffinity(const std::vector<int> &cpus);
+
+    // Dequantized outputs of the last Invoke, allocated once per session
+    int OutputLen(int index);
+    float* Output(int index);
+    void SetOutputBuffer(int index, float* buffer);
+    // Converts a copy of output tensor `index` taken after Invoke
+    void ConvertOutput(int index, const void* raw, float* out);
+
+    // Top k classes of every batch item of output 0, best first, taken
+    // straight from the output tensor: quantized outputs are ranked on their
+    // raw values and only the k survivors are dequantized. Fills batch_ * k
+    // entries and returns k, clamped to pred_len_.
+    int TopK(int k, int* indices, float* scores);
+    int TopK(const void* raw, int k, int* indices, float* scores, std::vector<std::pair<float, int>> &heap);
+
+    // Label table, loaded once and kept resident
+    int LoadLabels(const std::string &label_file);
+    const char* Label(int index);
+
+    std::shared_ptr<tflite::FlatBufferModel> net_;
+    std::unique_ptr<tflite::Interpreter> interpreter;
+    std::unique_ptr<tflite::profiling::Profiler> profiler_;
+    TfLiteDelegate* gpu_delegate_ = nullptr;
+    TfLiteDelegate* xnnpack_delegate_ = nullptr; // only with TFLITE_HAS_XNNPACK
+    int input_ = 0; // tensor index of interpreter->inputs()[0]
+    int output_ = 0; // tensor index of interpreter->outputs()[0]
+    int width_, height_, channels_;
+    int batch_;
+    int pred_len_ = 0;
+    int mode_ = 0;
+    int threads_ = 0; // CPU threads of mode_, after the shared policy's cap
+    std::vector<int> cpus_; // invokes run pinned here when not empty
+    OpStats op_stats_; // filled by Invoke when profile_ is set
+    StageTimings stage_stats_; // always on
+    StartupStats startup_ = StartupStats();
+    long long invokes_ = 0;
+    std::shared_ptr<ResultCache> result_cache_; // null unless enabled
+    uint64_t model_hash_ = 0;
+    TfLiteTensor* result_;
+    float* result_float_ = nullptr; // Output(0)
+    bool quantize_ = false;
+    bool verbose_ = false; // display model details
+    bool allow_fp16_ = false;
+    bool profile_ = false; // operator level profiling
+    bool read_outputs_ = true; // InvokeTflite converts every output to float
+    QuantTable input_table_; // pixel byte -> quantized input tensor, see Prepare
+    Normalization input_norm_; // applied to float inputs, see SetNormalizationTflite
+    bool normalize_ = false; // input_norm_ is not the identity
+
+  private:
+    Predictor(const ModelLoad &load, int batch, int mode, bool verbose, bool profile);
+    void Prepare();
+    void Release(); // interpreter, delegates and CPU lease
+    int LeaseThreads(int threads);
+    void SetNumThreads();
+    void RecordStartupInvoke(double ms);
+    uint64_t InputHash();
+    std::vector<TfLiteTensor*> OutputTensors();
+    const ResizePlan &GetResizePlan(int height, int width);
+
+    // resize plans per source (height, width), the target is the model input
+    std::map<std::pair<int, int>, ResizePlan> resize_plans_;
+    bool ResizeBatch(int batch);
+    void AllocateOutputs();
+
+    std::vector<std::vector<float>> outputs_;
+    std::vector<float*> caller_outputs_; // overrides outputs_ when set
+    std::vector<std::pair<float, int>> topk_heap_; // TopK scratch
+    CpuLease lease_; // PREDICTOR_THREADS_SHARED only
+    // CPU backend context shared with the predictors leasing the same cores
+    std::shared_ptr<SharedBackend> shared_backend_;
+    bool outputs_stale_ = false; // see DeferOutputs
+    std::vector<std::string> labels_;
+};
+
+#endif  // __PREDICTOR_IMPL_HPP__
@@ -0,0 +1,101 @@
+#ifndef __PREPROCESS_HPP__
+#define __PREPROCESS_HPP__
+
+#include <stdint.h>
+
+#include <vector>
+
+/*
+  Native image preprocessing: bilinear resize (align_corners = false, same
+  sampling as TFLite's RESIZE_BILINEAR), per-channel normalization and
+  conversion to the model's input type, fused into one pass over the image.
+  The row kernels have AVX2 / NEON implementations picked at runtime, with a
+  scalar fallback.
+*/
+
+// element type of the source image
+enum SourceType {
+  kSourceInt32 = 0,
+  kSourceFloat32 = 1,
+  kSourceUInt8 = 2,
+};
+
+// memory layout of the source image
+enum SourceLayout {
+  kLayoutHWC = 0,
+  kLayoutCHW = 1,
+};
+
+struct SourceFormat {
+  SourceType type = kSourceInt32;
+  int channels = 3;
+  SourceLayout layout = kLayoutHWC;
+  bool bgr = false; // channels are stored BGR and are swapped to RGB
+};
+
+// element type of the destination tensor
+enum TargetType {
+  kTargetFloat32 = 0,
+  kTargetUInt8 = 1,
+  kTargetInt8 = 2,
+};
+
+// Interpolation coefficients for one source -> destination geometry
+struct ResizePlan {
+  int src_height = 0, src_width = 0;
+  int dst_height = 0, dst_width = 0;
+  std::vector<int> y0, y1;  // source rows blended for each output row
+  std::vector<float> fy;    // weight of y1
+  std::vector<int> x0, x1;  // source columns blended for each output column
+  std::vector<float> fx;    // weight of x1
+  // fy / fx in kResizeWeightBits fixed point, for the integer path
+  std::vector<int> wy, wx;
+};
+
+const int kResizeWeightBits = 8;
+
+void BuildResizePlan(int src_height, int src_width, int dst_height, int dst_width, ResizePlan* plan);
+
+// out = (in - mean[c]) * scale[c], applied after resizing
+struct Normalization {
+  float mean[4] = {0, 0, 0, 0};
+  float scale[4] = {1, 1, 1, 1};
+};
+
+// Resizes one image into the HWC tensor dst. Destination channel c reads
+// source channel c % channels (after the BGR swap). Integer targets are
+// rounded to nearest and saturated.
+void ResizeImage(const void* src, const SourceFormat& format,
+                 void* dst, TargetType dst_type, int dst_channels,
+                 const ResizePlan& plan, const Normalization& norm);
+
+// Maps a source byte straight to the quantized value of the destination
+// tensor, per destination channel (c & 3). int8 values are stored as their
+// two's complement byte.
+struct QuantTable {
+  uint8_t value[4][256];
+};
+
+// Source bytes are taken as the model's uint8 quantization of the input, so
+// no scale or zero point is involved: the table is the identity for
+// kTargetUInt8 and subtracts 128 (the zero point shift between the uint8
+// and int8 forms of one quantization) for kTargetInt8
+void BuildQuantTable(TargetType dst_type, QuantTable* table);
+
+// Integer counterpart of ResizeImage for uint8 sources and uint8 / int8
+// destinations: fixed point bilinear interpolation, rounded to the nearest
+// byte, then mapped through table. No float conversion on the way.
+void ResizeImageQuantized(const uint8_t* src, const SourceFormat& format,
+                          void* dst, int dst_channels,
+                          const ResizePlan& plan, const QuantTable& table);
+
+// Maps an image already in the destination geometry (HWC, same channels)
+// through table. dst may be src. The int32 variant first clamps each value
+// to [0, 255].
+void QuantizeImage(const uint8_t* src, int pixels, int channels, void* dst, const QuantTable& table);
+void QuantizeImage(const int* src, int pixels, int channels, void* dst, const QuantTable& table);
+
+// Name of the row kernels selected for this CPU ("avx2", "neon" or "scalar")
+const char* PreprocessKernelName();
+
+#endif  // __PREPROCESS_HPP__
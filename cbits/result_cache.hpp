@@ -0,0 +1,55 @@
+#ifndef __RESULT_CACHE_HPP__
+#define __RESULT_CACHE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/lite/c_api_internal.h"
+
+#include "predictor.hpp"
+
+/*
+  Bounded LRU cache of inference results, keyed by a hash of the input
+  tensors (seeded with the model hash). An entry holds the raw bytes of every
+  output tensor, so a hit restores the outputs exactly as Invoke would have
+  left them. The cache is split into independently locked shards so that the
+  instances of a pool can share one cache without contending on a single lock.
+*/
+class ResultCache {
+  public:
+    explicit ResultCache(size_t capacity_bytes);
+
+    // Copies the cached outputs for key into the output tensors
+    bool Lookup(uint64_t key, const std::vector<TfLiteTensor*> &outputs);
+    void Insert(uint64_t key, const std::vector<TfLiteTensor*> &outputs);
+    void Stats(ResultCacheStats* stats);
+
+  private:
+    static const int kShards = 8;
+
+    struct Entry {
+      uint64_t key;
+      std::vector<char> outputs; // every output tensor, back to back
+    };
+
+    struct Shard {
+      std::mutex mutex;
+      std::list<Entry> lru; // most recently used first
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+      size_t bytes = 0;
+      long long hits = 0;
+      long long misses = 0;
+      long long evictions = 0;
+    };
+
+    static size_t EntryBytes(const Entry &entry);
+
+    size_t shard_capacity_;
+    Shard shards_[kShards];
+};
+
+#endif  // __RESULT_CACHE_HPP__
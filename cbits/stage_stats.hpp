@@ -0,0 +1,56 @@
+#ifndef __STAGE_STATS_HPP__
+#define __STAGE_STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "predictor.hpp"
+
+/*
+  Always-on latency histograms for the stages of a request. Samples are
+  nanoseconds from steady_clock, counted into log-linear buckets (HDR style,
+  32 sub-buckets per power of two, so ~3% relative error) with relaxed atomic
+  increments: recording never locks and GetStatsTflite may read the
+  histograms while another thread is predicting.
+*/
+class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void Record(uint64_t ns);
+    void Reset();
+    void Summarize(StageStats* out) const;
+
+  private:
+    static const int kSubBucketBits = 5;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kMaxBits = 40; // samples are clamped to 2^40 ns (~18 min)
+    static const int kBuckets = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    static int BucketIndex(uint64_t ns);
+    static uint64_t BucketMidpoint(int index);
+
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> total_ns_;
+    std::atomic<uint64_t> max_ns_;
+    std::atomic<uint64_t> buckets_[kBuckets];
+};
+
+class StageTimings {
+  public:
+    void Record(int stage, std::chrono::steady_clock::time_point start) {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      stages_[stage].Record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    void Reset();
+
+    // Writes up to max stages (in PREDICTOR_STAGE_* order) and returns the
+    // number of stages
+    int Export(StageStats* out, int max) const;
+
+  private:
+    LatencyHistogram stages_[PREDICTOR_NUM_STAGES];
+};
+
+#endif  // __STAGE_STATS_HPP__
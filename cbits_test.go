@@ -0,0 +1,82 @@
+package tflite
+
+import (
+	"os"
+	"testing"
+)
+
+// Model the benchmarks run, TFLITE_TEST_MODEL or the bundled test model
+func benchmarkModel(b *testing.B) *PredictorData {
+	model := os.Getenv("TFLITE_TEST_MODEL")
+	if model == "" {
+		model = "testdata/tiny.tflite"
+	}
+	if _, err := os.Stat(model); err != nil {
+		b.Skipf("no test model: %v", err)
+	}
+
+	p, err := New(model, CPU_1_thread, 1, false, false)
+	if err != nil {
+		b.Skipf("unable to load %s: %v", model, err)
+	}
+	return p
+}
+
+// One image of the model geometry, int32 elements for quantized models and
+// float32 otherwise
+func benchmarkInput(b *testing.B, p *PredictorData) ([]byte, bool, ImageGeometry) {
+	input, err := Inputs(p)
+	if err != nil || len(input) == 0 || len(input[0].Shape) != 4 {
+		b.Skip("model input is not an NHWC image")
+	}
+	geometry := ImageGeometry{
+		Height:   input[0].Shape[1],
+		Width:    input[0].Shape[2],
+		Channels: input[0].Shape[3],
+		Layout:   LayoutHWC,
+	}
+	quantize := input[0].Type != 1
+	return make([]byte, geometry.Height*geometry.Width*geometry.Channels*4), quantize, geometry
+}
+
+// Before: run inference, then one cgo call per output to count, describe and
+// copy it out
+func BenchmarkPredictReadOutputs(b *testing.B) {
+	p := benchmarkModel(b)
+	defer Close(p)
+	data, quantize, geometry := benchmarkInput(b, p)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for ii := 0; ii < b.N; ii++ {
+		if err := PredictImage(p, data, quantize, geometry); err != nil {
+			b.Fatal(err)
+		}
+		for jj := 0; jj < NumOutputs(p); jj++ {
+			if _, _, err := ReadOutput(p, jj); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+}
+
+// After: a single cgo call runs inference and writes every output into a
+// reused Go slice
+func BenchmarkPredictInto(b *testing.B) {
+	p := benchmarkModel(b)
+	defer Close(p)
+	data, quantize, geometry := benchmarkInput(b, p)
+
+	out, _, err := PredictInto(p, data, quantize, geometry, nil)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for ii := 0; ii < b.N; ii++ {
+		if out, _, err = PredictInto(p, data, quantize, geometry, out); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
@@ -0,0 +1,217 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+using std::chrono::steady_clock;
+
+/*
+  Accuracy / throughput evaluation over a packed, memory-mapped tensor file
+  (EvalFileHeader). Images go straight from the mapping into the input
+  tensor: no decoding, no cgo. While batch N is invoked, batch N+1 is copied
+  (or resized) into a staging buffer on a second thread and the pages of
+  batch N+2 are requested from the kernel.
+*/
+namespace {
+
+const int kTopK = 5;
+
+double ElapsedMs(steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+class MappedFile {
+  public:
+    explicit MappedFile(const char* path) {
+      const int fd = open(path, O_RDONLY);
+      if(fd < 0) {
+        return;
+      }
+      struct stat st;
+      if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+          data_ = static_cast<const char*>(data);
+          size_ = st.st_size;
+          madvise(data, size_, MADV_SEQUENTIAL);
+        }
+      }
+      close(fd);
+    }
+    ~MappedFile() {
+      if(data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+      }
+    }
+
+    // Asks the kernel to read [offset, offset + len) ahead of use
+    void WillNeed(size_t offset, size_t len) const {
+      const size_t page = sysconf(_SC_PAGESIZE);
+      const size_t begin = offset / page * page;
+      const size_t end = std::min(size_, offset + len);
+      if(begin < end) {
+        madvise(const_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+      }
+    }
+
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+bool ValidHeader(const EvalFileHeader &header, size_t file_size) {
+  if(strncmp(header.magic, PREDICTOR_EVAL_MAGIC, sizeof(header.magic)) != 0 ||
+     header.version != PREDICTOR_EVAL_VERSION || header.count < 0 ||
+     header.height < 1 || header.width < 1 || header.channels < 1 ||
+     (header.dtype != PREDICTOR_EVAL_UINT8 && header.dtype != PREDICTOR_EVAL_FLOAT32)) {
+    return false;
+  }
+  if(file_size < sizeof(EvalFileHeader)) {
+    return false;
+  }
+  // each product is checked against the payload before the next multiply,
+  // so a forged header cannot wrap the size around and pass
+  const size_t payload = file_size - sizeof(EvalFileHeader);
+  size_t image_bytes = header.dtype == PREDICTOR_EVAL_UINT8 ? 1 : sizeof(float);
+  for(int32_t dim : {header.height, header.width, header.channels}) {
+    if(image_bytes > payload / dim) {
+      return false;
+    }
+    image_bytes *= dim;
+  }
+  return (size_t)header.count <= payload / (image_bytes + sizeof(int32_t));
+}
+
+}  // namespace
+
+int EvaluateTflite(PredictorContext pred, char* path, int label_offset, long long limit, EvalStats* stats) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || path == nullptr || stats == nullptr) {
+    return -1;
+  }
+  memset(stats, 0, sizeof(EvalStats));
+
+  MappedFile file(path);
+  if(file.data_ == nullptr || file.size_ < sizeof(EvalFileHeader)) {
+    LOG(FATAL) << "Failed to map evaluation file " << path << "\n";
+    return -1;
+  }
+  EvalFileHeader header;
+  memcpy(&header, file.data_, sizeof(header));
+  if(!ValidHeader(header, file.size_)) {
+    LOG(FATAL) << "Invalid evaluation file " << path << "\n";
+    return -1;
+  }
+
+  TfLiteTensor* input_tensor = predictor->interpreter->tensor(predictor->input_);
+  TargetType target;
+  switch(input_tensor->type) {
+    case kTfLiteFloat32: target = kTargetFloat32; break;
+    case kTfLiteUInt8: target = kTargetUInt8; break;
+    case kTfLiteInt8: target = kTargetInt8; break;
+    default:
+      LOG(FATAL) << "Unsupported input type: " << input_tensor->type << "\n";
+      return -1;
+  }
+
+  const bool uint8_images = header.dtype == PREDICTOR_EVAL_UINT8;
+  const size_t image_bytes = (size_t)header.height * header.width * header.channels *
+                             (uint8_images ? 1 : sizeof(float));
+  const char* images = file.data_ + sizeof(EvalFileHeader);
+  const char* labels = images + (size_t)header.count * image_bytes;
+  const long long count = limit > 0 ? std::min<long long>(limit, header.count) : header.count;
+  const int batch = predictor->batch_;
+  const int slot_bytes = input_tensor->bytes / batch;
+
+  // images already in the tensor's geometry and type are copied as is
+  const bool direct = header.height == predictor->height_ && header.width == predictor->width_ &&
+                      header.channels == predictor->channels_ &&
+                      ((uint8_images && target == kTargetUInt8) ||
+                       (!uint8_images && target == kTargetFloat32 && !predictor->normalize_));
+  // float inputs get the predictor's normalization, quantized ones never do
+  const Normalization norm = target == kTargetFloat32 ? predictor->input_norm_ : Normalization();
+  SourceFormat format;
+  format.type = uint8_images ? kSourceUInt8 : kSourceFloat32;
+  format.channels = header.channels;
+  ResizePlan plan;
+  BuildResizePlan(header.height, header.width, predictor->height_, predictor->width_, &plan);
+
+  // fills staging with the batch starting at image `first`
+  auto prepare = [&](long long first, std::vector<char>* staging) {
+    const auto start_time = steady_clock::now();
+    const long long last = std::min(first + batch, count);
+    for(long long i = first; i < last; i++) {
+      char* slot = staging->data() + (i - first) * slot_bytes;
+      if(direct) {
+        memcpy(slot, images + i * image_bytes, image_bytes);
+      } else if(uint8_images && target == kTargetInt8) {
+        // the byte convention of every other entry point: offset by -128
+        ResizeImage(images + i * image_bytes, format, slot, kTargetUInt8, predictor->channels_, plan, Normalization());
+        QuantizeImage((const uint8_t*)slot, predictor->height_ * predictor->width_, predictor->channels_, slot,
+                      predictor->input_table_);
+      } else {
+        ResizeImage(images + i * image_bytes, format, slot, target, predictor->channels_, plan, norm);
+      }
+    }
+    file.WillNeed(sizeof(EvalFileHeader) + last * image_bytes, (size_t)batch * image_bytes);
+    predictor->stage_stats_.Record(direct ? PREDICTOR_STAGE_QUANTIZE : PREDICTOR_STAGE_PREPROCESS, start_time);
+  };
+
+  std::vector<char> staging[2] = {std::vector<char>(input_tensor->bytes), std::vector<char>(input_tensor->bytes)};
+  std::vector<int> indices(batch * kTopK);
+  std::vector<float> scores(batch * kTopK);
+  file.WillNeed(sizeof(EvalFileHeader), (size_t)batch * image_bytes);
+
+  const auto start_time = steady_clock::now();
+  std::future<void> pending;
+  if(count > 0) {
+    pending = std::async(std::launch::async, prepare, 0, &staging[0]);
+  }
+  for(long long first = 0, n = 0; first < count; first += batch, n++) {
+    auto wait_time = steady_clock::now();
+    pending.get();
+    stats->prefetch_wait_ms += ElapsedMs(wait_time);
+    memcpy(input_tensor->data.raw, staging[n % 2].data(), input_tensor->bytes);
+    if(first + batch < count) {
+      pending = std::async(std::launch::async, prepare, first + batch, &staging[(n + 1) % 2]);
+    }
+
+    const auto invoke_time = steady_clock::now();
+    predictor->Invoke();
+    stats->invoke_ms += ElapsedMs(invoke_time);
+
+    const int k = predictor->TopK(kTopK, indices.data(), scores.data());
+    const long long valid = std::min<long long>(batch, count - first);
+    for(long long b = 0; b < valid; b++) {
+      int32_t label;
+      memcpy(&label, labels + (first + b) * sizeof(int32_t), sizeof(label));
+      for(int j = 0; j < k; j++) {
+        if(indices[b * k + j] - label_offset == label) {
+          stats->top1 += j == 0;
+          stats->top5++;
+          break;
+        }
+      }
+    }
+    stats->images += valid;
+  }
+  stats->total_ms = ElapsedMs(start_time);
+
+  if(stats->images > 0) {
+    stats->top1_accuracy = (double)stats->top1 / stats->images;
+    stats->top5_accuracy = (double)stats->top5 / stats->images;
+    stats->images_per_sec = stats->images / (stats->total_ms / 1000);
+  }
+  return 0;
+}
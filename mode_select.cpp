@@ -0,0 +1,224 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "affinity.hpp"
+#include "hash.hpp"
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+using std::chrono::steady_clock;
+
+/*
+  PREDICTOR_MODE_AUTO: every CPU configuration available in this build
+  (builtin kernels and, with TFLITE_HAS_XNNPACK, the XNNPACK delegate, each
+  with 1, 2, 4 and all online threads up to 8) is timed on the actual model
+  and the fastest is kept. Results go to a small text cache, one line per
+  model hash / CPU signature / batch size, so later startups skip the probe.
+  The cache lives in the user's own cache directory, is rewritten whole
+  (through a private temporary file and a rename) with one line per key,
+  and a cached mode is only used if this build could have chosen it.
+*/
+namespace {
+
+const int kProbeInvokes = 5;
+
+std::mutex cache_mutex;
+
+struct CacheEntry {
+  uint64_t model;
+  uint64_t cpu;
+  int batch;
+  int mode;
+};
+
+// $TFLITE_PREDICTOR_MODE_CACHE, else tflite-predictor-modes in
+// $XDG_CACHE_HOME or ~/.cache, else a per-user file in /tmp
+std::string CacheFile() {
+  const char* path = getenv("TFLITE_PREDICTOR_MODE_CACHE");
+  if(path != nullptr && path[0] != '\0') {
+    return path;
+  }
+  std::string dir;
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if(xdg != nullptr && xdg[0] == '/') {
+    dir = xdg;
+  } else if(home != nullptr && home[0] == '/') {
+    dir = std::string(home) + "/.cache";
+  }
+  struct stat info;
+  if(!dir.empty() && (mkdir(dir.c_str(), 0700) == 0 || (stat(dir.c_str(), &info) == 0 && S_ISDIR(info.st_mode)))) {
+    return dir + "/tflite-predictor-modes";
+  }
+  return "/tmp/tflite-predictor-modes-" + std::to_string(getuid());
+}
+
+// Every entry of the cache, the last one for each key; call with
+// cache_mutex held
+std::vector<CacheEntry> ReadCache(const std::string &path) {
+  std::vector<CacheEntry> entries;
+  FILE* file = fopen(path.c_str(), "r");
+  if(file == nullptr) {
+    return entries;
+  }
+  CacheEntry entry;
+  while(fscanf(file, "%" SCNx64 " %" SCNx64 " %d %d", &entry.model, &entry.cpu, &entry.batch, &entry.mode) == 4) {
+    // later lines win
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const CacheEntry &e) {
+      return e.model == entry.model && e.cpu == entry.cpu && e.batch == entry.batch;
+    }), entries.end());
+    entries.push_back(entry);
+  }
+  fclose(file);
+  return entries;
+}
+
+// CPU model and features plus the delegates compiled in: a cached choice is
+// only reused on the same kind of machine and build
+uint64_t CpuSignature() {
+  std::string signature;
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while(std::getline(cpuinfo, line)) {
+    if(line.compare(0, 10, "model name") == 0 || line.compare(0, 5, "flags") == 0 ||
+       line.compare(0, 8, "Features") == 0 || line.compare(0, 8, "CPU part") == 0 ||
+       line.compare(0, 15, "CPU implementer") == 0 || line.compare(0, 8, "Hardware") == 0) {
+      signature += line;
+      signature += '\n';
+    }
+  }
+  signature += "cpus " + std::to_string(OnlineCpus());
+#ifdef TFLITE_HAS_XNNPACK
+  signature += " xnnpack";
+#endif  // TFLITE_HAS_XNNPACK
+  return XXH64(signature.data(), signature.size());
+}
+
+int LookupMode(uint64_t model, uint64_t cpu, int batch) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  for(const CacheEntry &entry : ReadCache(CacheFile())) {
+    if(entry.model == model && entry.cpu == cpu && entry.batch == batch) {
+      return entry.mode;
+    }
+  }
+  return 0;
+}
+
+// Rewrites the cache with the entry for this key replaced. The new file is
+// created with mkstemp (never following a planted link) next to the cache
+// and renamed over it, so readers see either version whole; concurrent
+// writers may drop each other's newest entry, which only costs a probe.
+void StoreMode(uint64_t model, uint64_t cpu, int batch, int mode) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  const std::string path = CacheFile();
+  std::vector<CacheEntry> entries = ReadCache(path);
+  entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const CacheEntry &e) {
+    return e.model == model && e.cpu == cpu && e.batch == batch;
+  }), entries.end());
+  entries.push_back(CacheEntry{model, cpu, batch, mode});
+
+  std::string temp = path + ".XXXXXX";
+  const int fd = mkstemp(&temp[0]);
+  if(fd < 0) {
+    return;
+  }
+  FILE* file = fdopen(fd, "w");
+  if(file == nullptr) {
+    close(fd);
+    unlink(temp.c_str());
+    return;
+  }
+  for(const CacheEntry &entry : entries) {
+    fprintf(file, "%016" PRIx64 " %016" PRIx64 " %d %d\n", entry.model, entry.cpu, entry.batch, entry.mode);
+  }
+  if(fclose(file) != 0 || rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+  }
+}
+
+std::vector<int> CandidateModes() {
+  const int cpus = std::min(OnlineCpus(), 8);
+  std::vector<int> threads;
+  for(int t : {1, 2, 4, cpus}) {
+    if(t <= cpus && std::find(threads.begin(), threads.end(), t) == threads.end()) {
+      threads.push_back(t);
+    }
+  }
+  std::vector<int> modes;
+  for(int t : threads) {
+    modes.push_back(t);
+#ifdef TFLITE_HAS_XNNPACK
+    modes.push_back(PREDICTOR_MODE_XNNPACK + t - 1);
+#endif  // TFLITE_HAS_XNNPACK
+  }
+  return modes;
+}
+
+// Median invoke latency of a throwaway predictor running `mode`
+double ProbeMode(const std::shared_ptr<tflite::FlatBufferModel> &net, int batch, int mode) {
+  Predictor candidate(net, batch, mode, false, false);
+  candidate.Warmup(1);
+  std::vector<double> latencies;
+  for(int i = 0; i < kProbeInvokes; i++) {
+    const auto start_time = steady_clock::now();
+    candidate.InvokeInterpreter();
+    latencies.push_back(std::chrono::duration<double, std::milli>(steady_clock::now() - start_time).count());
+  }
+  std::nth_element(latencies.begin(), latencies.begin() + kProbeInvokes / 2, latencies.end());
+  return latencies[kProbeInvokes / 2];
+}
+
+}  // namespace
+
+uint64_t ModelHash(const tflite::FlatBufferModel &net) {
+  const tflite::Allocation* allocation = net.allocation();
+  if(allocation == nullptr) {
+    return 0;
+  }
+  return XXH64(allocation->base(), allocation->bytes());
+}
+
+int SelectMode(const std::shared_ptr<tflite::FlatBufferModel> &net, int batch, bool verbose) {
+  const uint64_t model = ModelHash(*net);
+  const uint64_t cpu = CpuSignature();
+  const std::vector<int> candidates = CandidateModes();
+  // the file is only a hint: anything this build would not probe is ignored
+  const int cached = LookupMode(model, cpu, batch);
+  if(std::find(candidates.begin(), candidates.end(), cached) != candidates.end()) {
+    if(verbose) {
+      LOG(INFO) << "Auto mode (cached): " << cached << "\n";
+    }
+    return cached;
+  }
+
+  int best_mode = 0;
+  double best_ms = 0;
+  for(int mode : candidates) {
+    const double ms = ProbeMode(net, batch, mode);
+    if(verbose) {
+      LOG(INFO) << "Auto mode probe: mode " << mode << ", " << ms << "ms\n";
+    }
+    if(best_mode == 0 || ms < best_ms) {
+      best_mode = mode;
+      best_ms = ms;
+    }
+  }
+  if(verbose) {
+    LOG(INFO) << "Auto mode: " << best_mode << "\n";
+  }
+  StoreMode(model, cpu, batch, best_mode);
+  return best_mode;
+}
@@ -0,0 +1,98 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+/*
+  Process-wide model cache. Predictors loading the same file share one mmapped
+  FlatBufferModel; an entry is keyed by path and revalidated against the
+  file's mtime and size, so a model replaced on disk is mapped afresh. The
+  cache only holds weak references unless the model was preloaded, in which
+  case it stays mapped until UnloadModelTflite.
+*/
+namespace {
+
+struct CacheEntry {
+  time_t mtime = 0;
+  off_t size = 0;
+  std::weak_ptr<tflite::FlatBufferModel> model;
+  std::shared_ptr<tflite::FlatBufferModel> pinned; // set by PreloadModelTflite
+};
+
+std::mutex cache_mutex;
+std::map<std::string, CacheEntry> cache;
+
+}  // namespace
+
+// Returns the cached model, mapping the file on a miss. Null when the file
+// cannot be mapped.
+ModelLoad LookupModel(const std::string &model_file, bool pin) {
+  const auto start_time = std::chrono::steady_clock::now();
+  ModelLoad load;
+  struct stat st;
+  if(stat(model_file.c_str(), &st) != 0) {
+    return load;
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  CacheEntry &entry = cache[model_file];
+  if(entry.mtime == st.st_mtime && entry.size == st.st_size) {
+    load.net = entry.model.lock();
+  }
+  load.cached = load.net != nullptr;
+  if(!load.cached) {
+    load.net = tflite::FlatBufferModel::BuildFromFile(model_file.c_str());
+    if(!load.net) {
+      cache.erase(model_file);
+      return load;
+    }
+    entry.mtime = st.st_mtime;
+    entry.size = st.st_size;
+    entry.model = load.net;
+    entry.pinned.reset();
+  }
+  if(pin) {
+    entry.pinned = load.net;
+  }
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+  load.ms = elapsed.count();
+  return load;
+}
+
+ModelLoad LoadModelCached(const std::string &model_file) {
+  ModelLoad load = LookupModel(model_file, false);
+  if(!load.net) {
+    LOG(FATAL) << "\nFailed to mmap model" << "\n";
+    exit(-1);
+  }
+  return load;
+}
+
+// mmaps the model file; the result can be shared by any number of predictors
+std::shared_ptr<tflite::FlatBufferModel> LoadModel(const std::string &model_file) {
+  return LoadModelCached(model_file).net;
+}
+
+int PreloadModelTflite(char* model_file) {
+  return LookupModel(model_file, true).net ? 0 : -1;
+}
+
+void UnloadModelTflite(char* model_file) {
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache.find(model_file);
+  if(it == cache.end()) {
+    return;
+  }
+  it->second.pinned.reset();
+  if(it->second.model.expired()) {
+    cache.erase(it);
+  }
+}
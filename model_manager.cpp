@@ -0,0 +1,280 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+using std::chrono::steady_clock;
+
+/*
+  ModelManager keeps many models within one memory budget. Each model costs
+  its mapped file plus, while resident, its interpreter's tensor arenas.
+  When a load would exceed the budget, the least recently used idle
+  interpreters are deleted first; their mapped models are kept, so a reload
+  only rebuilds the interpreter. Mappings are dropped as well, oldest first,
+  only when deleting interpreters is not enough. Models in use (acquired and
+  not yet released) are never evicted, so the budget can be exceeded while
+  everything resident is busy. A predictor is handed to one acquirer at a
+  time; others wait for its release. A failed (re)load leaves the model
+  evicted and fails only that acquisition.
+*/
+class ModelManager {
+  public:
+    explicit ModelManager(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+    bool Add(const std::string &name, const std::string &model_file, int batch, int mode);
+    // Null with errno ENOENT for an unknown name, EIO when loading failed
+    Predictor* Acquire(const std::string &name);
+    void Release(const std::string &name);
+    bool Stats(const std::string &name, ModelStats* stats);
+    void Stats(ManagerStats* stats);
+
+  private:
+    struct Entry {
+      std::string model_file;
+      int batch;
+      int mode;
+      size_t file_bytes;
+      std::shared_ptr<tflite::FlatBufferModel> net; // null when unmapped
+      std::unique_ptr<Predictor> predictor;         // null when evicted
+      bool loading = false;
+      long long last_use = 0;
+      ModelStats stats = ModelStats();
+    };
+
+    size_t UsedBytes();
+    void MakeRoom(size_t incoming, const Entry* keep);
+
+    std::mutex mutex_;
+    std::condition_variable loaded_;
+    std::map<std::string, Entry> entries_;
+    size_t budget_bytes_;
+    long long clock_ = 0; // use counter, orders entries by recency
+    long long hits_ = 0;
+    long long loads_ = 0;
+    long long evictions_ = 0;
+    long long unmaps_ = 0;
+};
+
+bool ModelManager::Add(const std::string &name, const std::string &model_file, int batch, int mode) {
+  struct stat st;
+  if(batch < 1 || stat(model_file.c_str(), &st) != 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if(entries_.count(name) != 0) {
+    return false;
+  }
+  Entry &entry = entries_[name];
+  entry.model_file = model_file;
+  entry.batch = batch;
+  entry.mode = mode;
+  entry.file_bytes = st.st_size;
+  return true;
+}
+
+size_t ModelManager::UsedBytes() {
+  size_t used = 0;
+  for(auto &it : entries_) {
+    used += it.second.stats.model_bytes + (it.second.predictor ? it.second.stats.arena_bytes : 0);
+  }
+  return used;
+}
+
+// Evicts idle interpreters, then idle mappings, least recently used first,
+// until incoming more bytes fit in the budget. Called with mutex_ held.
+void ModelManager::MakeRoom(size_t incoming, const Entry* keep) {
+  for(int pass = 0; pass < 2; pass++) {
+    while(UsedBytes() + incoming > budget_bytes_) {
+      Entry* victim = nullptr;
+      for(auto &it : entries_) {
+        Entry &entry = it.second;
+        const bool candidate = pass == 0 ? entry.predictor != nullptr : entry.net != nullptr && !entry.predictor;
+        if(&entry != keep && candidate && !entry.loading && entry.stats.in_use == 0 &&
+           (victim == nullptr || entry.last_use < victim->last_use)) {
+          victim = &entry;
+        }
+      }
+      if(victim == nullptr) {
+        break;
+      }
+      if(pass == 0) {
+        victim->predictor.reset();
+        victim->stats.resident = false;
+        victim->stats.evictions++;
+        evictions_++;
+      } else {
+        victim->net.reset();
+        victim->stats.mapped = false;
+        victim->stats.model_bytes = 0;
+        unmaps_++;
+      }
+    }
+  }
+}
+
+Predictor* ModelManager::Acquire(const std::string &name) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = entries_.find(name);
+  if(it == entries_.end()) {
+    errno = ENOENT;
+    return nullptr;
+  }
+  Entry &entry = it->second;
+  // Predictor is not thread-safe: one acquirer at a time
+  loaded_.wait(lock, [&entry] { return !entry.loading && entry.stats.in_use == 0; });
+  entry.last_use = ++clock_;
+  entry.stats.uses++;
+  entry.stats.in_use++;
+  if(entry.predictor) {
+    hits_++;
+    return entry.predictor.get();
+  }
+
+  // an evicted model is expected to come back at its previous size
+  MakeRoom(entry.stats.arena_bytes + (entry.net ? 0 : entry.file_bytes), &entry);
+  entry.loading = true;
+  std::shared_ptr<tflite::FlatBufferModel> net = entry.net;
+  lock.unlock();
+
+  // build outside the lock, other models stay available meanwhile. The file
+  // may have been removed or replaced since Add.
+  const auto start_time = steady_clock::now();
+  if(!net) {
+    net = LookupModel(entry.model_file, false).net;
+  }
+  std::unique_ptr<Predictor> predictor;
+  if(net) {
+    try {
+      predictor.reset(new Predictor(net, entry.batch, entry.mode, false, false));
+      predictor->Warmup(1);
+    } catch(const std::exception &ex) {
+      LOG(FATAL) << "Failed to build " << entry.model_file << ": " << ex.what() << "\n";
+      predictor.reset();
+    }
+  } else {
+    LOG(FATAL) << "Failed to mmap model " << entry.model_file << "\n";
+  }
+  const size_t arena_bytes = predictor ? predictor->ArenaBytes() : 0;
+  const double load_ms = std::chrono::duration<double, std::milli>(steady_clock::now() - start_time).count();
+
+  lock.lock();
+  if(!predictor) {
+    entry.loading = false;
+    entry.stats.in_use--;
+    loaded_.notify_all();
+    errno = EIO;
+    return nullptr;
+  }
+  entry.net = net;
+  entry.predictor = std::move(predictor);
+  entry.loading = false;
+  entry.stats.resident = true;
+  entry.stats.mapped = true;
+  entry.stats.model_bytes = net->allocation() != nullptr ? net->allocation()->bytes() : 0;
+  entry.stats.arena_bytes = arena_bytes;
+  entry.stats.loads++;
+  entry.stats.last_load_ms = load_ms;
+  entry.stats.total_load_ms += load_ms;
+  loads_++;
+  MakeRoom(0, &entry);
+  loaded_.notify_all();
+  return entry.predictor.get();
+}
+
+void ModelManager::Release(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(name);
+  if(it != entries_.end() && it->second.stats.in_use > 0) {
+    it->second.stats.in_use--;
+    loaded_.notify_all();
+  }
+}
+
+bool ModelManager::Stats(const std::string &name, ModelStats* stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(name);
+  if(it == entries_.end()) {
+    return false;
+  }
+  *stats = it->second.stats;
+  return true;
+}
+
+void ModelManager::Stats(ManagerStats* stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  memset(stats, 0, sizeof(ManagerStats));
+  stats->budget_bytes = budget_bytes_;
+  stats->used_bytes = UsedBytes();
+  stats->models = entries_.size();
+  for(auto &it : entries_) {
+    stats->resident += it.second.predictor != nullptr;
+  }
+  stats->hits = hits_;
+  stats->loads = loads_;
+  stats->evictions = evictions_;
+  stats->unmaps = unmaps_;
+}
+
+ManagerContext NewModelManagerTflite(size_t budget_bytes) {
+  return (void *) new ModelManager(budget_bytes);
+}
+
+int AddModelTflite(ManagerContext m, char* name, char* model_file, int batch, int mode) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr || name == nullptr || model_file == nullptr) {
+    return -1;
+  }
+  return manager->Add(name, model_file, batch, mode) ? 0 : -1;
+}
+
+PredictorContext AcquireModelTflite(ManagerContext m, char* name) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr || name == nullptr) {
+    return nullptr;
+  }
+  return (void *) manager->Acquire(name);
+}
+
+void ReleaseModelTflite(ManagerContext m, char* name) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr || name == nullptr) {
+    return;
+  }
+  manager->Release(name);
+}
+
+int GetModelStatsTflite(ManagerContext m, char* name, ModelStats* stats) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr || name == nullptr || stats == nullptr) {
+    return -1;
+  }
+  return manager->Stats(name, stats) ? 0 : -1;
+}
+
+void GetManagerStatsTflite(ManagerContext m, ManagerStats* stats) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr || stats == nullptr) {
+    return;
+  }
+  manager->Stats(stats);
+}
+
+void DeleteModelManagerTflite(ManagerContext m) {
+  auto manager = (ModelManager *)m;
+  if (manager == nullptr) {
+    return;
+  }
+  delete manager;
+}
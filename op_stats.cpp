@@ -0,0 +1,135 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "op_stats.hpp"
+
+void OpStats::Record(int node_index, int op_code, const char* op_name, double ms) {
+  Entry &entry = nodes_[node_index];
+  if(entry.count == 0) {
+    entry.op_code = op_code;
+    entry.op_name = op_name ? op_name : "";
+    entry.samples.reserve(kSamples);
+  }
+  if(entry.samples.size() < kSamples) {
+    entry.samples.push_back(ms);
+  } else {
+    entry.samples[entry.count % kSamples] = ms;
+  }
+  entry.count++;
+  entry.total_ms += ms;
+}
+
+void OpStats::Reset() {
+  nodes_.clear();
+}
+
+static double Percentile(std::vector<float> &samples, double p) {
+  if(samples.empty()) {
+    return 0;
+  }
+  const size_t rank = std::min(samples.size() - 1, (size_t)(p * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  return samples[rank];
+}
+
+void OpStats::Summarize(int node_index, const Entry &entry, OpProfile* out) {
+  memset(out, 0, sizeof(*out));
+  out->node_index = node_index;
+  out->op_code = entry.op_code;
+  strncpy(out->op_name, entry.op_name.c_str(), sizeof(out->op_name) - 1);
+  out->count = entry.count;
+  out->total_ms = entry.total_ms;
+  out->mean_ms = entry.count ? entry.total_ms / entry.count : 0;
+  std::vector<float> samples(entry.samples);
+  out->p50_ms = Percentile(samples, 0.50);
+  out->p99_ms = Percentile(samples, 0.99);
+}
+
+std::vector<OpProfile> OpStats::Rows(bool by_op_type) const {
+  std::vector<OpProfile> rows;
+  if(!by_op_type) {
+    for(const auto &node : nodes_) {
+      OpProfile row;
+      Summarize(node.first, node.second, &row);
+      rows.push_back(row);
+    }
+    return rows;
+  }
+
+  // merge the nodes of every op type; counts and totals are summed across
+  // nodes, percentiles come from the pooled samples
+  std::map<std::string, Entry> types;
+  for(const auto &node : nodes_) {
+    Entry &merged = types[node.second.op_name];
+    merged.op_code = node.second.op_code;
+    merged.op_name = node.second.op_name;
+    merged.count += node.second.count;
+    merged.total_ms += node.second.total_ms;
+    merged.samples.insert(merged.samples.end(), node.second.samples.begin(), node.second.samples.end());
+  }
+  for(const auto &type : types) {
+    OpProfile row;
+    Summarize(-1, type.second, &row);
+    rows.push_back(row);
+  }
+  // most expensive op types first
+  std::sort(rows.begin(), rows.end(), [](const OpProfile &a, const OpProfile &b) {
+    return a.total_ms > b.total_ms;
+  });
+  return rows;
+}
+
+int OpStats::Export(OpProfile* out, int max, bool by_op_type) const {
+  const std::vector<OpProfile> rows = Rows(by_op_type);
+  if(out != nullptr) {
+    std::copy(rows.begin(), rows.begin() + std::min((int)rows.size(), std::max(max, 0)), out);
+  }
+  return rows.size();
+}
+
+bool OpStats::Dump(const std::string &path, int format) const {
+  std::ofstream file(path);
+  if(!file) {
+    return false;
+  }
+  const std::vector<OpProfile> nodes = Rows(false);
+  const std::vector<OpProfile> types = Rows(true);
+  if(format == PREDICTOR_PROFILE_CSV) {
+    file << "node,op_code,op_name,count,total_ms,mean_ms,p50_ms,p99_ms\n";
+    for(const auto &rows : {nodes, types}) {
+      for(const auto &row : rows) {
+        file << row.node_index << "," << row.op_code << "," << row.op_name << ","
+             << row.count << "," << row.total_ms << "," << row.mean_ms << ","
+             << row.p50_ms << "," << row.p99_ms << "\n";
+      }
+    }
+    return (bool)file;
+  }
+
+  file << "{\n";
+  const char* sections[] = {"nodes", "op_types"};
+  for(int s = 0; s < 2; s++) {
+    const std::vector<OpProfile> &rows = s == 0 ? nodes : types;
+    file << "  \"" << sections[s] << "\": [\n";
+    for(size_t i = 0; i < rows.size(); i++) {
+      const OpProfile &row = rows[i];
+      file << "    {\"node\": " << row.node_index
+           << ", \"op_code\": " << row.op_code
+           << ", \"op_name\": \"" << row.op_name << "\""
+           << ", \"count\": " << row.count
+           << ", \"total_ms\": " << row.total_ms
+           << ", \"mean_ms\": " << row.mean_ms
+           << ", \"p50_ms\": " << row.p50_ms
+           << ", \"p99_ms\": " << row.p99_ms << "}"
+           << (i + 1 < rows.size() ? "," : "") << "\n";
+    }
+    file << "  ]" << (s == 0 ? "," : "") << "\n";
+  }
+  file << "}\n";
+  return (bool)file;
+}
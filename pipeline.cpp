@@ -0,0 +1,295 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+using std::chrono::steady_clock;
+
+/*
+  Pipeline runs the stages of a request on three threads connected by bounded
+  queues: preprocessing into a staging copy of the input tensor, Invoke, and
+  output conversion / top-K from a staging copy of output 0. While request N
+  is invoked, request N+1 is preprocessed and request N-1 post-processed.
+  Each of the depth slots carries its own staging buffers, and Submit blocks
+  while every slot is in flight. A slot is recycled as soon as its outputs
+  are written; completions awaiting PollTflite only keep (id, user_data), so
+  a caller may submit any number of requests before polling.
+*/
+namespace {
+
+template <typename T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    void Push(T value) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+      queue_.push_back(std::move(value));
+      not_empty_.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained
+    bool Pop(T* value) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+      if(queue_.empty()) {
+        return false;
+      }
+      *value = std::move(queue_.front());
+      queue_.pop_front();
+      not_full_.notify_one();
+      return true;
+    }
+
+    void Close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      not_empty_.notify_all();
+    }
+
+  private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> queue_;
+    bool closed_ = false;
+};
+
+}  // namespace
+
+class Pipeline {
+  public:
+    Pipeline(Predictor* predictor, int depth, int topk);
+    ~Pipeline();
+    long long Submit(int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry &geometry,
+                     float* out, int* topk_indices, float* topk_scores,
+                     PipelineCallback callback, void* user_data);
+    int Poll(long long* id, void** user_data, bool wait);
+
+  private:
+    struct Slot {
+      long long id;
+      int* inputData_quantize;
+      float* inputData_float;
+      bool quantize;
+      ImageGeometry geometry;
+      float* out;
+      int* topk_indices;
+      float* topk_scores;
+      PipelineCallback callback;
+      void* user_data;
+      std::vector<char> input;  // staged input tensor
+      std::vector<char> output; // staged output 0
+    };
+
+    void Preprocess();
+    void Run();
+    void Postprocess();
+
+    Predictor* predictor_;
+    int topk_;
+    std::vector<Slot> slots_;
+    BoundedQueue<Slot*> free_;
+    BoundedQueue<Slot*> preprocess_;
+    BoundedQueue<Slot*> invoke_;
+    BoundedQueue<Slot*> postprocess_;
+    std::vector<std::thread> workers_;
+
+    // completions without a callback, guarded by mutex_
+    std::mutex mutex_;
+    std::condition_variable done_cond_;
+    std::deque<std::pair<long long, void*>> done_; // (id, user_data)
+    int awaiting_poll_ = 0;
+    long long next_id_ = 0;
+};
+
+Pipeline::Pipeline(Predictor* predictor, int depth, int topk)
+  : predictor_(predictor), topk_(topk),
+    free_(depth), preprocess_(depth), invoke_(depth), postprocess_(depth) {
+  if(depth < 1 || topk < 0) {
+    throw std::invalid_argument("invalid pipeline configuration");
+  }
+  const TfLiteTensor* input = predictor_->interpreter->tensor(predictor_->input_);
+  const TfLiteTensor* output = predictor_->interpreter->tensor(predictor_->output_);
+  slots_.resize(depth);
+  for(Slot &slot : slots_) {
+    slot.input.resize(input->bytes);
+    slot.output.resize(output->bytes);
+    free_.Push(&slot);
+  }
+  workers_.emplace_back(&Pipeline::Preprocess, this);
+  workers_.emplace_back(&Pipeline::Run, this);
+  workers_.emplace_back(&Pipeline::Postprocess, this);
+}
+
+// Serves everything already submitted, then stops the stages in order
+Pipeline::~Pipeline() {
+  preprocess_.Close();
+  for(std::thread &worker : workers_) {
+    worker.join();
+  }
+}
+
+long long Pipeline::Submit(int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry &geometry,
+                           float* out, int* topk_indices, float* topk_scores,
+                           PipelineCallback callback, void* user_data) {
+  Slot* slot = nullptr;
+  free_.Pop(&slot);
+  slot->inputData_quantize = inputData_quantize;
+  slot->inputData_float = inputData_float;
+  slot->quantize = quantize;
+  slot->geometry = geometry;
+  slot->out = out;
+  slot->topk_indices = topk_indices;
+  slot->topk_scores = topk_scores;
+  slot->callback = callback;
+  slot->user_data = user_data;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    slot->id = next_id_++;
+    if(callback == nullptr) {
+      awaiting_poll_++;
+    }
+  }
+  const long long id = slot->id;
+  preprocess_.Push(slot);
+  return id;
+}
+
+void Pipeline::Preprocess() {
+  Slot* slot = nullptr;
+  while(preprocess_.Pop(&slot)) {
+    const int source_size = slot->geometry.height * slot->geometry.width * slot->geometry.channels;
+    for(int b = 0; b < predictor_->batch_; b++) {
+      predictor_->FillInputBuffer(slot->input.data(), b,
+                                  slot->inputData_quantize ? slot->inputData_quantize + b * source_size : nullptr,
+                                  slot->inputData_float ? slot->inputData_float + b * source_size : nullptr,
+                                  slot->quantize, slot->geometry);
+    }
+    invoke_.Push(slot);
+  }
+  invoke_.Close();
+}
+
+// The only stage touching the interpreter's tensors. Copying the staged input
+// in and output 0 out is what lets the other stages run concurrently.
+void Pipeline::Run() {
+  Slot* slot = nullptr;
+  TfLiteTensor* input = predictor_->interpreter->tensor(predictor_->input_);
+  const TfLiteTensor* output = predictor_->interpreter->tensor(predictor_->output_);
+  while(invoke_.Pop(&slot)) {
+    memcpy(input->data.raw, slot->input.data(), slot->input.size());
+    predictor_->Invoke();
+    memcpy(slot->output.data(), output->data.raw, slot->output.size());
+    postprocess_.Push(slot);
+  }
+  postprocess_.Close();
+}
+
+void Pipeline::Postprocess() {
+  Slot* slot = nullptr;
+  std::vector<std::pair<float, int>> heap;
+  while(postprocess_.Pop(&slot)) {
+    if(slot->out != nullptr) {
+      const auto start_time = steady_clock::now();
+      predictor_->ConvertOutput(0, slot->output.data(), slot->out);
+      predictor_->stage_stats_.Record(PREDICTOR_STAGE_DEQUANTIZE, start_time);
+    }
+    if(topk_ > 0 && slot->topk_indices != nullptr && slot->topk_scores != nullptr) {
+      predictor_->TopK(slot->output.data(), topk_, slot->topk_indices, slot->topk_scores, heap);
+    }
+    const long long id = slot->id;
+    void* user_data = slot->user_data;
+    const PipelineCallback callback = slot->callback;
+    free_.Push(slot);
+    if(callback != nullptr) {
+      callback(user_data, id);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_.push_back(std::make_pair(id, user_data));
+    done_cond_.notify_all();
+  }
+}
+
+int Pipeline::Poll(long long* id, void** user_data, bool wait) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if(wait) {
+    done_cond_.wait(lock, [this] { return !done_.empty() || awaiting_poll_ == 0; });
+  }
+  if(done_.empty()) {
+    return 0;
+  }
+  const std::pair<long long, void*> done = done_.front();
+  done_.pop_front();
+  awaiting_poll_--;
+  if(id != nullptr) {
+    *id = done.first;
+  }
+  if(user_data != nullptr) {
+    *user_data = done.second;
+  }
+  return 1;
+}
+
+PipelineContext NewPipelineTflite(PredictorContext pred, int depth, int topk) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return nullptr;
+  }
+  try {
+    const auto ctx = new Pipeline(predictor, depth, topk);
+    return (void *) ctx;
+  } catch(const std::invalid_argument &ex) {
+    errno = EINVAL;
+    return nullptr;
+  }
+}
+
+long long SubmitTflite(PipelineContext pl, int* inputData_quantize, float* inputData_float, bool quantize,
+                       const ImageGeometry* geometry, float* out, int* topk_indices, float* topk_scores,
+                       PipelineCallback callback, void* user_data) {
+  auto pipeline = (Pipeline *)pl;
+  if (pipeline == nullptr) {
+    return -1;
+  }
+  if (geometry != nullptr &&
+      (geometry->height < 1 || geometry->width < 1 || geometry->channels < 1 ||
+       (geometry->layout != PREDICTOR_LAYOUT_HWC && geometry->layout != PREDICTOR_LAYOUT_CHW))) {
+    LOG(FATAL) << "Invalid image geometry " << geometry->height << "x" << geometry->width
+               << "x" << geometry->channels << ", layout " << geometry->layout << "\n";
+    return -1;
+  }
+  return pipeline->Submit(inputData_quantize, inputData_float, quantize,
+                          geometry != nullptr ? *geometry : kDefaultGeometry,
+                          out, topk_indices, topk_scores, callback, user_data);
+}
+
+int PollTflite(PipelineContext pl, long long* id, void** user_data, bool wait) {
+  auto pipeline = (Pipeline *)pl;
+  if (pipeline == nullptr) {
+    return 0;
+  }
+  return pipeline->Poll(id, user_data, wait);
+}
+
+void DeletePipelineTflite(PipelineContext pl) {
+  auto pipeline = (Pipeline *)pl;
+  if (pipeline == nullptr) {
+    return;
+  }
+  delete pipeline;
+}
@@ -0,0 +1,220 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "affinity.hpp"
+#include "predictor.hpp"
+#include "predictor_impl.hpp"
+
+/*
+  PredictorPool owns n interpreters built from one shared, mmapped model.
+  Idle instances sit on a lock-free free-list (a Treiber stack of instance
+  indices whose head carries a generation tag against ABA), so concurrent
+  callers each get an exclusive interpreter without taking a lock. Only
+  when every instance is busy does a caller sleep on a condition variable,
+  which Release signals when someone is waiting.
+*/
+class PredictorPool {
+  public:
+    PredictorPool(const std::string &model_file, int n_instances, int threads_per_instance,
+                  int batch, bool pin_threads, bool verbose, bool profile);
+    void Predict(int* inputData_quantize, float* inputData_float, bool quantize, float* out);
+    void SetResultCache(std::shared_ptr<ResultCache> cache);
+
+    std::shared_ptr<ResultCache> result_cache_;
+
+    int batch_;
+    int pred_len_ = 0;
+
+  private:
+    int Acquire();
+    void Release(int index);
+
+    std::shared_ptr<tflite::FlatBufferModel> net_;
+    std::vector<std::unique_ptr<Predictor>> instances_;
+    std::vector<std::vector<int>> cpus_; // empty when not pinned
+    std::unique_ptr<std::atomic<int>[]> next_;
+    // low 32 bits: index + 1 of the top instance (0 = empty), high 32 bits: tag
+    std::atomic<uint64_t> head_;
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    std::atomic<int> waiters_; // callers asleep in Acquire
+};
+
+PredictorPool::PredictorPool(const std::string &model_file, int n_instances, int threads_per_instance,
+                             int batch, bool pin_threads, bool verbose, bool profile)
+  : batch_(batch), head_(0), waiters_(0) {
+  if(n_instances < 1 || threads_per_instance < 1 || threads_per_instance > 8 || batch < 1) {
+    throw std::invalid_argument("invalid pool configuration");
+  }
+  net_ = LoadModel(model_file);
+  instances_.resize(n_instances);
+  cpus_.resize(n_instances);
+  next_.reset(new std::atomic<int>[n_instances]);
+
+  // Build every interpreter on a thread pinned to the instance's CPUs and
+  // run one invoke there, so the interpreter's worker threads are spawned
+  // with (and inherit) that affinity. Under PREDICTOR_THREADS_SHARED each
+  // instance already leases and pins itself to its own cores; a fixed range
+  // on top would pin the calling thread away from them.
+  const bool pin = pin_threads && ThreadPolicy() != PREDICTOR_THREADS_SHARED;
+  for(int i = 0; i < n_instances; i++) {
+    if(pin) {
+      cpus_[i] = CpuRange(i * threads_per_instance, threads_per_instance);
+    }
+    std::exception_ptr failure;
+    std::thread builder([&, i] {
+      PinCurrentThread(cpus_[i]);
+      try {
+        instances_[i].reset(new Predictor(net_, batch, threads_per_instance, verbose, profile));
+        instances_[i]->Warmup(1);
+      } catch(...) {
+        failure = std::current_exception();
+      }
+    });
+    builder.join();
+    if(failure) {
+      // the instances built so far return their CPU leases as instances_ goes
+      std::rethrow_exception(failure);
+    }
+  }
+  pred_len_ = instances_[0]->pred_len_;
+
+  for(int i = n_instances - 1; i >= 0; i--) {
+    Release(i);
+  }
+}
+
+int PredictorPool::Acquire() {
+  uint64_t head = head_.load(std::memory_order_acquire);
+  for(;;) {
+    const int index = (int)(head & 0xffffffffu) - 1;
+    if(index < 0) {
+      // every instance is busy: sleep until Release pushes one. waiters_ and
+      // head_ are both seq_cst so that either the releaser sees the waiter or
+      // the waiter sees the pushed instance.
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      {
+        std::unique_lock<std::mutex> lock(idle_mutex_);
+        idle_.wait(lock, [this] { return (head_.load(std::memory_order_seq_cst) & 0xffffffffu) != 0; });
+      }
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+      head = head_.load(std::memory_order_acquire);
+      continue;
+    }
+    const int next = next_[index].load(std::memory_order_relaxed);
+    const uint64_t tag = (head >> 32) + 1;
+    const uint64_t new_head = (tag << 32) | (uint32_t)(next + 1);
+    if(head_.compare_exchange_weak(head, new_head, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      return index;
+    }
+  }
+}
+
+void PredictorPool::Release(int index) {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  for(;;) {
+    next_[index].store((int)(head & 0xffffffffu) - 1, std::memory_order_relaxed);
+    const uint64_t tag = (head >> 32) + 1;
+    const uint64_t new_head = (tag << 32) | (uint32_t)(index + 1);
+    if(head_.compare_exchange_weak(head, new_head, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  if(waiters_.load(std::memory_order_seq_cst) > 0) {
+    // taking the mutex orders this notify after a waiter's predicate check
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    idle_.notify_one();
+  }
+}
+
+void PredictorPool::Predict(int* inputData_quantize, float* inputData_float, bool quantize, float* out) {
+  const int index = Acquire();
+  {
+    // the calling thread takes part in the computation, keep it on the
+    // instance's CPUs as well
+    ScopedAffinity affinity(cpus_[index]);
+    Predictor* predictor = instances_[index].get();
+    predictor->Predict(inputData_quantize, inputData_float, quantize);
+    predictor->SyncOutputs();
+    std::copy(predictor->result_float_, predictor->result_float_ + batch_ * pred_len_, out);
+  }
+  Release(index);
+}
+
+// Hands one cache to every instance; the model hash is computed once
+void PredictorPool::SetResultCache(std::shared_ptr<ResultCache> cache) {
+  const uint64_t model_hash = cache != nullptr ? ModelHash(*net_) : 0;
+  result_cache_ = cache;
+  for(auto &instance : instances_) {
+    instance->SetResultCache(cache, model_hash);
+  }
+}
+
+PoolContext NewTflitePool(char *model_file, int n_instances, int threads_per_instance, int batch,
+                          bool pin_threads, bool verbose, bool profile) {
+  try {
+    const auto ctx = new PredictorPool(model_file, n_instances, threads_per_instance, batch,
+                                       pin_threads, verbose, profile);
+    return (void *) ctx;
+  } catch(const std::invalid_argument &ex) {
+    errno = EINVAL;
+    return nullptr;
+  }
+}
+
+void PredictTflitePool(PoolContext p, int* inputData_quantize, float* inputData_float, bool quantize, float* out) {
+  auto pool = (PredictorPool *)p;
+  if (pool == nullptr) {
+    return;
+  }
+  pool->Predict(inputData_quantize, inputData_float, quantize, out);
+}
+
+int GetPredLenTflitePool(PoolContext p) {
+  auto pool = (PredictorPool *)p;
+  if (pool == nullptr) {
+    return 0;
+  }
+  return pool->pred_len_;
+}
+
+int EnableResultCacheTflitePool(PoolContext p, size_t capacity_bytes) {
+  auto pool = (PredictorPool *)p;
+  if (pool == nullptr) {
+    return -1;
+  }
+  pool->SetResultCache(capacity_bytes > 0 ? std::make_shared<ResultCache>(capacity_bytes) : nullptr);
+  return 0;
+}
+
+void GetResultCacheStatsTflitePool(PoolContext p, ResultCacheStats* stats) {
+  auto pool = (PredictorPool *)p;
+  if (pool == nullptr || stats == nullptr) {
+    return;
+  }
+  if(pool->result_cache_ == nullptr) {
+    memset(stats, 0, sizeof(ResultCacheStats));
+    return;
+  }
+  pool->result_cache_->Stats(stats);
+}
+
+void DeleteTflitePool(PoolContext p) {
+  auto pool = (PredictorPool *)p;
+  if (pool == nullptr) {
+    return;
+  }
+  delete pool;
+}
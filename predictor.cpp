@@ -1,89 +1,119 @@
 #define _GLIBCXX_USE_CXX11_ABI 0
 
+#include <sched.h>
+
 #include <algorithm>
+#include <fstream>
 #include <iosfwd>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
+#include <mutex>
 #include <iostream>
 #include <iomanip>
-#include <sys/time.h>
+#include <chrono>
 
 #include "absl/memory/memory.h"
 #include "tensorflow/lite/delegates/nnapi/nnapi_delegate.h"
-#include "tensorflow/lite/profiling/profiler.h"
 #include "tensorflow/lite/string_util.h"
 #include "tensorflow/lite/tools/evaluation/utils.h"
-#include "tensorflow/lite/interpreter.h"
 #include "tensorflow/lite/kernels/register.h"
-#include "tensorflow/lite/model.h"
 #include "tensorflow/lite/optional_debug_tools.h"
 #include "tensorflow/lite/delegates/gpu/gl_delegate.h"
-#include "tensorflow/lite/builtin_op_data.h"
+#ifdef TFLITE_HAS_XNNPACK
+#include "tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h"
+#endif  // TFLITE_HAS_XNNPACK
+#ifdef TFLITE_HAS_CPU_BACKEND_CONTEXT
+#include "tensorflow/lite/external_cpu_backend_context.h"
+#include "tensorflow/lite/kernels/cpu_backend_context.h"
+#endif  // TFLITE_HAS_CPU_BACKEND_CONTEXT
 
+#include "affinity.hpp"
 #include "predictor.hpp"
-
-#define LOG(x) std::cerr
+#include "predictor_impl.hpp"
+#include "preprocess.hpp"
+#include "hash.hpp"
 
 using namespace tflite;
 using std::string;
+using std::chrono::steady_clock;
+
+const ImageGeometry kDefaultGeometry = {224, 224, 3, PREDICTOR_LAYOUT_HWC, false};
 
-double get_us(struct timeval t) { return (t.tv_sec * 1000000 + t.tv_usec); }
-
-/*
-  Predictor class takes in model file (converted into .tflite from the original .pb file
-  using tflite_convert CLI tool), batch size and device mode for inference
-*/
-class Predictor {
-  public:
-    Predictor(const string &model_file, int batch, int mode, bool verbose, bool profile);
-    void Predict(int* inputData_quantize, float* inputData_float, bool quantize);
-
-    std::unique_ptr<tflite::FlatBufferModel> net_;
-    std::unique_ptr<tflite::Interpreter> interpreter;
-    int width_, height_, channels_;
-    int batch_;
-    int pred_len_ = 0;
-    int mode_ = 0;
-    TfLiteTensor* result_;
-    float* result_float_;
-    bool quantize_ = false;
-    bool verbose_ = false; // display model details
-    bool allow_fp16_ = false;
-    bool profile_ = false; // operator level profiling
-    bool read_outputs_ = true;
+#ifdef TFLITE_HAS_CPU_BACKEND_CONTEXT
+// With PREDICTOR_THREADS_SHARED, predictors on builtin kernels that lease
+// the same cores share one CPU backend context: one ruy / gemmlowp worker
+// pool, pinned to those cores, instead of one per interpreter. Predictors on
+// other cores have contexts of their own and run in parallel. A context is
+// not thread-safe, so only the invokes on one context are serialized, by its
+// mutex. A context goes away with the last predictor using it.
+struct SharedBackend {
+  tflite::ExternalCpuBackendContext context;
+  std::mutex mutex;
 };
 
-Predictor::Predictor(const string &model_file, int batch, int mode, bool verbose, bool profile) {
-  char* model_file_char = const_cast<char*>(model_file.c_str());
+static std::shared_ptr<SharedBackend> SharedBackendFor(std::vector<int> cpus) {
+  static std::mutex backends_mutex;
+  static std::map<std::vector<int>, std::weak_ptr<SharedBackend>> backends;
+  std::sort(cpus.begin(), cpus.end());
+  std::lock_guard<std::mutex> lock(backends_mutex);
+  for(auto it = backends.begin(); it != backends.end();) {
+    it = it->second.expired() ? backends.erase(it) : std::next(it);
+  }
+  std::shared_ptr<SharedBackend> backend = backends[cpus].lock();
+  if(backend == nullptr) {
+    backend = std::make_shared<SharedBackend>();
+    backend->context.set_internal_backend_context(absl::make_unique<tflite::CpuBackendContext>());
+    backends[cpus] = backend;
+  }
+  return backend;
+}
+#endif  // TFLITE_HAS_CPU_BACKEND_CONTEXT
+
+Predictor::Predictor(const string &model_file, int batch, int mode, bool verbose, bool profile)
+  : Predictor(LoadModelCached(model_file), batch, mode, verbose, profile) {}
+
+Predictor::Predictor(const ModelLoad &load, int batch, int mode, bool verbose, bool profile)
+  : Predictor(load.net, batch, mode, verbose, profile) {
+  startup_.model_cached = load.cached;
+  startup_.model_ms = load.ms;
+}
+
+Predictor::Predictor(std::shared_ptr<tflite::FlatBufferModel> net, int batch, int mode, bool verbose, bool profile) {
+  if(batch < 1) {
+    throw std::invalid_argument("batch size must be positive");
+  }
   
   // set verbosity and profiling levels
   profile_ = profile;
   verbose_ = verbose;
  
   // build a runnable model from given model file
-  struct timeval start_time, stop_time;
-  gettimeofday(&start_time, nullptr); 
-  net_ = tflite::FlatBufferModel::BuildFromFile(model_file_char);
-  if(!net_){
-    LOG(FATAL) << "\nFailed to mmap model" << "\n";
-    exit(-1);    
-  }
+  const auto start_time = steady_clock::now();
+  net_ = net;
   net_->error_reporter();
   LOG(INFO) << "resolved reporter\n";
   tflite::ops::builtin::BuiltinOpResolver resolver;
   tflite::InterpreterBuilder(*net_, resolver)(&interpreter);
   if(!interpreter) {
-    LOG(FATAL) << "Failed to construct interpreter\n";
+    throw std::invalid_argument("failed to construct interpreter");
   }	
-  gettimeofday(&stop_time, nullptr);
   // log model loading time
   if(verbose_) {
-    LOG(INFO) << "Model loading (C++): " << (get_us(stop_time) - get_us(start_time))/1000 << "ms \n";
+    const std::chrono::duration<double, std::milli> elapsed = steady_clock::now() - start_time;
+    LOG(INFO) << "Model loading (C++): " << elapsed.count() << "ms \n";
   }
   mode_ = mode;
   batch_ = batch;
+  if(mode_ == PREDICTOR_MODE_AUTO) {
+    const auto probe_time = steady_clock::now();
+    mode_ = SelectMode(net_, batch_, verbose_);
+    const std::chrono::duration<double, std::milli> probe_elapsed = steady_clock::now() - probe_time;
+    startup_.probe_ms = probe_elapsed.count();
+  }
+  startup_.mode = mode_;
   
   // log model architecture
   if(verbose_) {
@@ -101,17 +131,101 @@ Predictor::Predictor(const string &model_file, int batch, int mode, bool verbose
                   << interpreter->tensor(i)->params.zero_point << "\n";
     }
   }
+
+  // the destructor does not run when a constructor throws
+  try {
+    Prepare();
+  } catch(...) {
+    Release();
+    throw;
+  }
+  const std::chrono::duration<double, std::milli> elapsed = steady_clock::now() - start_time;
+  startup_.interpreter_ms = elapsed.count();
+}
+
+Predictor::~Predictor() {
+  Release();
 }
 
-void Predictor::Predict(int* inputData_quantize, float* inputData_float, bool quantize) {
-  int input = interpreter->inputs()[0];
-  if(verbose_)
-    LOG(INFO) << "input: " << input << "\n";
-  const std::vector<int> inputs = interpreter->inputs();
-  const std::vector<int> outputs = interpreter->outputs();
+void Predictor::Release() {
+  // the interpreter references the delegate, so it has to go first
+  interpreter.reset();
+  if(gpu_delegate_ != nullptr) {
+    TfLiteGpuDelegateDelete(gpu_delegate_);
+    gpu_delegate_ = nullptr;
+  }
+#ifdef TFLITE_HAS_XNNPACK
+  if(xnnpack_delegate_ != nullptr) {
+    TfLiteXNNPackDelegateDelete(xnnpack_delegate_);
+    xnnpack_delegate_ = nullptr;
+  }
+#endif  // TFLITE_HAS_XNNPACK
+  shared_backend_.reset();
+  ReturnCpus(lease_);
+  lease_ = CpuLease();
+}
+
+// Under PREDICTOR_THREADS_SHARED, caps `threads` to the physical cores not
+// yet leased by other predictors and pins this one to the cores granted
+int Predictor::LeaseThreads(int threads) {
+  if(ThreadPolicy() != PREDICTOR_THREADS_SHARED) {
+    return threads;
+  }
+  lease_ = LeaseCpus(threads);
+  cpus_ = lease_.cpus;
+  return lease_.threads;
+}
+
+// Worker threads inherit the mask of the thread that starts them, so the
+// thread count is applied while pinned to cpus_
+void Predictor::SetNumThreads() {
+  ScopedAffinity affinity(cpus_);
+  interpreter->SetNumThreads(threads_);
+}
+
+void Predictor::SetAffinity(const std::vector<int> &cpus) {
+  cpus_ = cpus;
+  SetNumThreads();
+}
+
+bool Predictor::InvokeInterpreter() {
+  ScopedAffinity affinity(cpus_);
+#ifdef TFLITE_HAS_CPU_BACKEND_CONTEXT
+  std::unique_lock<std::mutex> lock;
+  if(shared_backend_ != nullptr) {
+    lock = std::unique_lock<std::mutex>(shared_backend_->mutex);
+    // the shared context runs with the thread count of its last user
+    interpreter->SetNumThreads(threads_);
+  }
+#endif  // TFLITE_HAS_CPU_BACKEND_CONTEXT
+  return interpreter->Invoke() == kTfLiteOk;
+}
+
+// One-time session setup: select the hardware backend, allocate tensors,
+// look up the input/output tensors and attach the profiler. Everything done
+// here used to be repeated on every call to Predict.
+void Predictor::Prepare() {
+  // Attach the profiler before any delegate rewrites the graph. Operator
+  // events are only recorded when both TFLite and this package are built
+  // with TFLITE_PROFILING_ENABLED (see lib.go). The buffer holds one event
+  // per node for a single invoke.
+  profiler_ = absl::make_unique<profiling::Profiler>(std::max<int>(1024, interpreter->nodes_size()));
+  interpreter->SetProfiler(profiler_.get());
+
+  input_ = interpreter->inputs()[0];
+  output_ = interpreter->outputs()[0];
   if(verbose_) {
-    LOG(INFO) << "number of inputs: " << inputs.size() << "\n";
-    LOG(INFO) << "number of outputs: " << outputs.size() << "\n";
+    LOG(INFO) << "input: " << input_ << "\n";
+    LOG(INFO) << "number of inputs: " << interpreter->inputs().size() << "\n";
+    LOG(INFO) << "number of outputs: " << interpreter->outputs().size() << "\n";
+  }
+
+  // resize the leading (batch) dimension of the input to the requested batch
+  // size before any delegate takes over the graph
+  const TfLiteIntArray* model_dims = interpreter->tensor(input_)->dims;
+  const bool batch_resized = model_dims->size == 4 && model_dims->data[0] != batch_;
+  if(!ResizeBatch(batch_)) {
+    throw std::invalid_argument("failed to resize input to batch size " + std::to_string(batch_));
   }
 
   // set appropriate hardware backend
@@ -125,11 +239,10 @@ void Predictor::Predict(int* inputData_quantize, float* inputData_float, bool qu
           .dynamic_batch_enabled = 0, // Not fully functional yet
         },
       };
-      auto* delegate = TfLiteGpuDelegateCreate(&options);
-      if(!delegate) {
+      gpu_delegate_ = TfLiteGpuDelegateCreate(&options);
+      if(!gpu_delegate_) {
         LOG(FATAL) << "Unable to create GPU delegate" << "\n";
-      }
-      if(interpreter->ModifyGraphWithDelegate(delegate) != kTfLiteOk) {
+      } else if(interpreter->ModifyGraphWithDelegate(gpu_delegate_) != kTfLiteOk) {
          LOG(FATAL) << "Failed to apply " << "GPU delegate" << "\n";
       } else {
          LOG(INFO) << "Applied " << "GPU delegate" << "\n";
@@ -142,41 +255,66 @@ void Predictor::Predict(int* inputData_quantize, float* inputData_float, bool qu
       }
       interpreter->UseNNAPI(true);
       break; }
-    case 1: {
-      interpreter->SetNumThreads(1); 
-      break; }
-    case 2: {
-      interpreter->SetNumThreads(2); 
-      break; }
-    case 3: {
-      interpreter->SetNumThreads(3); 
-      break; }
-    case 4: {
-      interpreter->SetNumThreads(4); 
-      break; }
-    case 5: {
-      interpreter->SetNumThreads(5); 
-      break; }
-    case 6: {
-      interpreter->SetNumThreads(6);
-      break; }
-    case 7: {
-      interpreter->SetNumThreads(7);
-      break; }
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+    case 5:
+    case 6:
+    case 7:
     case 8: {
-      interpreter->SetNumThreads(8);
+      threads_ = LeaseThreads(mode_);
+      SetNumThreads();
+      break; }
+    case 11:
+    case 12:
+    case 13:
+    case 14:
+    case 15:
+    case 16:
+    case 17:
+    case 18: {
+      threads_ = LeaseThreads(mode_ - PREDICTOR_MODE_XNNPACK + 1);
+#ifdef TFLITE_HAS_XNNPACK
+      TfLiteXNNPackDelegateOptions options = TfLiteXNNPackDelegateOptionsDefault();
+      options.num_threads = threads_;
+      {
+        // the delegate starts its thread pool right away
+        ScopedAffinity affinity(cpus_);
+        xnnpack_delegate_ = TfLiteXNNPackDelegateCreate(&options);
+      }
+      if(!xnnpack_delegate_) {
+        LOG(FATAL) << "Unable to create XNNPACK delegate" << "\n";
+      } else if(interpreter->ModifyGraphWithDelegate(xnnpack_delegate_) != kTfLiteOk) {
+         LOG(FATAL) << "Failed to apply " << "XNNPACK delegate" << "\n";
+      } else {
+         LOG(INFO) << "Applied " << "XNNPACK delegate" << "\n";
+      }
+#else
+      LOG(INFO) << "XNNPACK is not available in this build, using builtin kernels" << "\n";
+#endif  // TFLITE_HAS_XNNPACK
+      // threads for the ops left to the builtin kernels
+      SetNumThreads();
       break; }
     default: {
-      interpreter->SetNumThreads(4); }
+      threads_ = LeaseThreads(4);
+      SetNumThreads(); }
   }
+
+#ifdef TFLITE_HAS_CPU_BACKEND_CONTEXT
+  if(lease_.threads > 0 && xnnpack_delegate_ == nullptr) {
+    // every user of the context holds the same cores, and its workers start
+    // on the first invoke, pinned to them like the rest of this predictor
+    shared_backend_ = SharedBackendFor(lease_.cpus);
+    interpreter->SetExternalContext(kTfLiteCpuBackendContext, &shared_backend_->context);
+  }
+#endif  // TFLITE_HAS_CPU_BACKEND_CONTEXT
   
   if(interpreter->AllocateTensors() != kTfLiteOk) {
     LOG(FATAL) << "Failed to allocate tensors!";
   }
 
-  // fill input buffers
-  TfLiteTensor* input_tensor = interpreter->tensor(input);
-  TfLiteIntArray* input_dims = input_tensor->dims;
+  TfLiteIntArray* input_dims = interpreter->tensor(input_)->dims;
   height_ = input_dims->data[1];
   width_ = input_dims->data[2];
   channels_ = input_dims->data[3];
@@ -184,112 +322,541 @@ void Predictor::Predict(int* inputData_quantize, float* inputData_float, bool qu
     LOG(INFO) << "Model input height is " << height_ << "\n";
     LOG(INFO) << "Model input width is " << width_ << "\n";
     LOG(INFO) << "Model input channel is " << channels_ << "\n";
+    LOG(INFO) << "Preprocessing kernels: " << PreprocessKernelName() << "\n";
+  }
+
+  // Quantized inputs (bytes, or int32 pixel values) are taken to be in the
+  // model's uint8 quantized domain already: they go in as is for uint8
+  // tensors and offset by -128 for int8 tensors, whatever the entry point
+  const TfLiteTensor* input_tensor = interpreter->tensor(input_);
+  BuildQuantTable(input_tensor->type == kTfLiteInt8 ? kTargetInt8 : kTargetUInt8, &input_table_);
+
+  // ReadOutput / TopK read batch_ * pred_len_ values of output 0. Only a
+  // batched output of a batch-resized input has to follow the new batch;
+  // anything else (a rank 1 [1001] classifier, say) is served as it is.
+  TfLiteIntArray* output_dims = interpreter->tensor(output_)->dims;
+  if(batch_resized && output_dims->size >= 2 && output_dims->data[0] != batch_) {
+    throw std::invalid_argument("model output batch " + std::to_string(output_dims->data[0]) +
+                                " does not match batch size " + std::to_string(batch_));
+  }
+  pred_len_ = OutputLen(0) / batch_;
+  caller_outputs_.assign(interpreter->outputs().size(), nullptr);
+  AllocateOutputs();
+}
+
+// Resizes the leading dimension of the input tensor. Tensors still have to be
+// (re)allocated afterwards.
+bool Predictor::ResizeBatch(int batch) {
+  TfLiteIntArray* model_dims = interpreter->tensor(input_)->dims;
+  if(model_dims->size != 4 || model_dims->data[0] == batch) {
+    return true;
+  }
+  const std::vector<int> batched_dims = {batch, model_dims->data[1], model_dims->data[2], model_dims->data[3]};
+  return interpreter->ResizeInputTensor(input_, batched_dims) == kTfLiteOk;
+}
+
+bool Predictor::SetBatch(int batch) {
+  if(batch == batch_) {
+    return true;
+  }
+  if(batch < 1 || gpu_delegate_ != nullptr || mode_ == 10) {
+    return false;
+  }
+  if(!ResizeBatch(batch) || interpreter->AllocateTensors() != kTfLiteOk) {
+    LOG(FATAL) << "Failed to resize input to batch size " << batch << "\n";
+    return false;
+  }
+  batch_ = batch;
+  AllocateOutputs();
+  return true;
+}
+
+// Resizes input `index` (of interpreter->inputs()) to dims. Tensors are only
+// reallocated when the shape actually changes. Returns false when the shape
+// is rejected or the backend cannot be resized (GPU / NNAPI).
+bool Predictor::ResizeInput(int index, const std::vector<int> &dims) {
+  const int tensor_index = interpreter->inputs()[index];
+  const TfLiteIntArray* current = interpreter->tensor(tensor_index)->dims;
+  if(current->size == (int)dims.size() && std::equal(dims.begin(), dims.end(), current->data)) {
+    return true;
+  }
+  if(gpu_delegate_ != nullptr || mode_ == 10) {
+    return false;
+  }
+  if(interpreter->ResizeInputTensor(tensor_index, dims) != kTfLiteOk ||
+     interpreter->AllocateTensors() != kTfLiteOk) {
+    LOG(FATAL) << "Failed to resize input " << index << "\n";
+    return false;
   }
+  // the image path keeps following input 0
+  if(tensor_index == input_ && dims.size() == 4) {
+    if(dims[1] != height_ || dims[2] != width_) {
+      resize_plans_.clear();
+    }
+    batch_ = dims[0];
+    height_ = dims[1];
+    width_ = dims[2];
+    channels_ = dims[3];
+  }
+  pred_len_ = OutputLen(0) / std::max(batch_, 1);
+  AllocateOutputs();
+  return true;
+}
+
+// The arenas are not exposed, so each one is measured as the extent of the
+// tensors placed in it. Dynamic tensors own their buffers and count in full.
+size_t Predictor::ArenaBytes() {
+  uintptr_t begin[2] = {UINTPTR_MAX, UINTPTR_MAX};
+  uintptr_t end[2] = {0, 0};
+  size_t bytes = 0;
+  for(size_t i = 0; i < interpreter->tensors_size(); i++) {
+    const TfLiteTensor* tensor = interpreter->tensor(i);
+    if(tensor->data.raw == nullptr) {
+      continue;
+    }
+    if(tensor->allocation_type == kTfLiteArenaRw || tensor->allocation_type == kTfLiteArenaRwPersistent) {
+      const int arena = tensor->allocation_type == kTfLiteArenaRw ? 0 : 1;
+      const uintptr_t address = reinterpret_cast<uintptr_t>(tensor->data.raw);
+      begin[arena] = std::min(begin[arena], address);
+      end[arena] = std::max(end[arena], address + tensor->bytes);
+    } else if(tensor->allocation_type == kTfLiteDynamic) {
+      bytes += tensor->bytes;
+    }
+  }
+  for(int arena = 0; arena < 2; arena++) {
+    if(end[arena] > begin[arena]) {
+      bytes += end[arena] - begin[arena];
+    }
+  }
+  return bytes;
+}
+
+// Number of elements of output tensor `index`
+int Predictor::OutputLen(int index) {
+  TfLiteIntArray* dims = interpreter->tensor(interpreter->outputs()[index])->dims;
+  int len = 1;
+  for(int i = 0; i < dims->size; i++) {
+    len *= dims->data[i];
+  }
+  return len;
+}
+
+// (Re)sizes the float buffers that hold the outputs of one Invoke. Called
+// once per session and whenever the batch size changes.
+void Predictor::AllocateOutputs() {
+  const int num_outputs = interpreter->outputs().size();
+  outputs_.resize(num_outputs);
+  for(int i = 0; i < num_outputs; i++) {
+    const int len = OutputLen(i);
+    if(outputs_[i].size() != len) {
+      // a caller buffer sized for the old shape can no longer be used
+      caller_outputs_[i] = nullptr;
+      outputs_[i].resize(len);
+    }
+  }
+  outputs_stale_ = false;
+  result_float_ = Output(0);
+}
 
+float* Predictor::Output(int index) {
+  return caller_outputs_[index] != nullptr ? caller_outputs_[index] : outputs_[index].data();
+}
+
+// Installs a caller owned buffer of at least OutputLen(index) floats for
+// output `index`, or reverts to the internal one when buffer is null
+void Predictor::SetOutputBuffer(int index, float* buffer) {
+  caller_outputs_[index] = buffer;
+  result_float_ = Output(0);
+}
+
+// Runs inference on batch_ images laid out back to back
+void Predictor::Predict(int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry &geometry) {
+  const int image_size = geometry.height * geometry.width * geometry.channels;
+  for(int b = 0; b < batch_; b++) {
+    FillInput(b,
+              inputData_quantize ? inputData_quantize + b * image_size : nullptr,
+              inputData_float ? inputData_float + b * image_size : nullptr,
+              quantize, geometry);
+  }
+  Invoke();
+  DeferOutputs();
+}
+
+const ResizePlan &Predictor::GetResizePlan(int height, int width) {
+  const std::pair<int, int> key(height, width);
+  auto it = resize_plans_.find(key);
+  if(it != resize_plans_.end()) {
+    return it->second;
+  }
+  // callers normally stick to a handful of source geometries
+  if(resize_plans_.size() >= 16) {
+    resize_plans_.clear();
+  }
+  ResizePlan &plan = resize_plans_[key];
+  BuildResizePlan(height, width, height_, width_, &plan);
+  return plan;
+}
+
+void Predictor::FillInput(int slot, int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry &geometry) {
+  FillInputBuffer(interpreter->tensor(input_)->data.raw, slot, inputData_quantize, inputData_float, quantize, geometry);
+}
+
+// Like FillInput, but writes into a buffer laid out like the input tensor
+void Predictor::FillInputBuffer(void* input, int slot, int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry &geometry) {
+  const auto start_time = steady_clock::now();
   // set quantization
   quantize_ = quantize;
-  const int size = batch_ * width_ * height_ * channels_;
+  const int size = width_ * height_ * channels_;
+  // images already in the model's geometry are copied as is
+  const bool direct = geometry.height == height_ && geometry.width == width_ &&
+                      geometry.channels == channels_ &&
+                      geometry.layout == PREDICTOR_LAYOUT_HWC && !geometry.bgr;
+  SourceFormat format;
+  format.type = quantize_ ? kSourceInt32 : kSourceFloat32;
+  format.channels = geometry.channels;
+  format.layout = geometry.layout == PREDICTOR_LAYOUT_CHW ? kLayoutCHW : kLayoutHWC;
+  format.bgr = geometry.bgr;
+  TfLiteTensor* input_tensor = interpreter->tensor(input_);
   // check if model bitwidth matches our expectation
-  // input image = 224 X 224 X 3
-  // resize it to what model expects if needed
-  if(interpreter->tensor(input)->type == kTfLiteFloat32 && quantize_ == false) {
-    LOG(INFO) << "Running float model" << "\n";
-    if(height_ != 224 || width_ != 224 | channels_ != 3) {
-      SetInputTflite_float(interpreter->typed_tensor<float>(input), inputData_float, 224, 224, 3, height_, width_, channels_);
+  if(input_tensor->type == kTfLiteFloat32 && quantize_ == false) {
+    if(verbose_)
+      LOG(INFO) << "Running float model" << "\n";
+    float* base_pointer = static_cast<float*>(input) + slot * size;
+    if(direct && !normalize_) {
+      memcpy(base_pointer, &inputData_float[0], size * sizeof(float));
     } else {
-      memcpy(interpreter->typed_tensor<float>(input), &inputData_float[0], size);
+      // a plan to the same geometry samples every pixel exactly once
+      ResizeImage(inputData_float, format, base_pointer, kTargetFloat32, channels_,
+                  GetResizePlan(geometry.height, geometry.width), input_norm_);
     }
-  } else if (interpreter->tensor(input)->type == kTfLiteUInt8 && quantize_ == true) {
-    LOG(INFO) << "Running 8-bit unsigned quantized model" << "\n";
-    if(height_ != 224 || width_ != 224 || channels_ != 3) {
-      SetInputTflite_quantize_8_unsigned(interpreter->typed_tensor<uint8_t>(input), inputData_quantize, 224, 224, 3, height_, width_, channels_);
+  } else if((input_tensor->type == kTfLiteUInt8 || input_tensor->type == kTfLiteInt8) && quantize_ == true) {
+    const bool int8 = input_tensor->type == kTfLiteInt8;
+    if(verbose_)
+      LOG(INFO) << "Running 8-bit " << (int8 ? "signed" : "unsigned") << " quantized model" << "\n";
+    // pixel values are rounded and clamped to [0, 255], then mapped through
+    // the same table as FillInputUInt8
+    uint8_t* base_pointer = static_cast<uint8_t*>(input) + slot * size;
+    if(direct) {
+      QuantizeImage(inputData_quantize, width_ * height_, channels_, base_pointer, input_table_);
     } else {
-      uint8_t* base_pointer = interpreter->typed_tensor<uint8_t>(input);
-      for(int i = 0; i < size; i++) {
-        base_pointer[i] = (uint8_t)inputData_quantize[i];
+      ResizeImage(inputData_quantize, format, base_pointer, kTargetUInt8, channels_,
+                  GetResizePlan(geometry.height, geometry.width), Normalization());
+      if(int8) {
+        QuantizeImage(base_pointer, width_ * height_, channels_, base_pointer, input_table_);
       }
     }
-  } else if(interpreter->tensor(input)->type == kTfLiteInt8 && quantize_ == true) {
-    LOG(INFO) << "Running 8-bit signed quantized model" << "\n";
-    if(height_ != 224 || width_ != 224 || channels_ != 3) {
-      SetInputTflite_quantize_8_signed(interpreter->typed_tensor<int8_t>(input), inputData_quantize, 224, 224, 3, height_, width_, channels_);
-    } else {
-      int8_t* base_pointer = interpreter->typed_tensor<int8_t>(input);
-      for(int i = 0; i < size; i++) {
-        base_pointer[i] = (int8_t)inputData_quantize[i];
+  } else {
+    LOG(FATAL) << "Unsupported input type: " << input_tensor->type << ", Quantize: " << quantize_ << "\n";
+    return;
+  }
+  stage_stats_.Record(direct ? PREDICTOR_STAGE_QUANTIZE : PREDICTOR_STAGE_PREPROCESS, start_time);
+}
+
+void Predictor::FillInputUInt8(int slot, const uint8_t* image, const ImageGeometry &geometry) {
+  const auto start_time = steady_clock::now();
+  const int size = width_ * height_ * channels_;
+  const bool direct = geometry.height == height_ && geometry.width == width_ &&
+                      geometry.channels == channels_ &&
+                      geometry.layout == PREDICTOR_LAYOUT_HWC && !geometry.bgr;
+  SourceFormat format;
+  format.type = kSourceUInt8;
+  format.channels = geometry.channels;
+  format.layout = geometry.layout == PREDICTOR_LAYOUT_CHW ? kLayoutCHW : kLayoutHWC;
+  format.bgr = geometry.bgr;
+  TfLiteTensor* input_tensor = interpreter->tensor(input_);
+  switch(input_tensor->type) {
+    case kTfLiteUInt8:
+    case kTfLiteInt8: {
+      uint8_t* base_pointer = input_tensor->data.uint8 + slot * size;
+      if(direct) {
+        QuantizeImage(image, width_ * height_, channels_, base_pointer, input_table_);
+      } else {
+        ResizeImageQuantized(image, format, base_pointer, channels_,
+                             GetResizePlan(geometry.height, geometry.width), input_table_);
       }
+      break; }
+    case kTfLiteFloat32:
+      ResizeImage(image, format, input_tensor->data.f + slot * size, kTargetFloat32, channels_,
+                  GetResizePlan(geometry.height, geometry.width), input_norm_);
+      break;
+    default:
+      LOG(FATAL) << "Unsupported input type: " << input_tensor->type << "\n";
+      return;
+  }
+  stage_stats_.Record(direct ? PREDICTOR_STAGE_QUANTIZE : PREDICTOR_STAGE_PREPROCESS, start_time);
+}
+
+void Predictor::Invoke() {
+  uint64_t cache_key = 0;
+  if(result_cache_ != nullptr) {
+    cache_key = InputHash();
+    if(result_cache_->Lookup(cache_key, OutputTensors())) {
+      return;
     }
-  } else {
-    LOG(FATAL) << "Unsupported input type: " << interpreter->tensor(input)->type << ", Quantize: " << quantize_ << "\n";
   }
 
-  // TODO interpreter profiler not fetching any information
-  auto profiler = absl::make_unique<profiling::Profiler>(1024);
-  interpreter->SetProfiler(profiler.get());
   if(profile_ == true) {
-    LOG(INFO) << "Starting profiler" << "\n";
-    profiler->StartProfiling();
+    profiler_->StartProfiling();
   }
 
-  struct timeval start_time, stop_time;
-  gettimeofday(&start_time, nullptr);  
+  const auto start_time = steady_clock::now();
   // run inference
-  if(interpreter->Invoke() != kTfLiteOk) {
+  if(!InvokeInterpreter()) {
     LOG(FATAL) << "Failed to invoke tflite" << "\n";
   }
-  gettimeofday(&stop_time, nullptr);
+  stage_stats_.Record(PREDICTOR_STAGE_INVOKE, start_time);
+  const std::chrono::duration<double, std::milli> elapsed = steady_clock::now() - start_time;
+  RecordStartupInvoke(elapsed.count());
   // log model inference
   if(verbose_) {
-    LOG(INFO) << "Model computation (C++): " << (get_us(stop_time) - get_us(start_time))/1000 << "ms \n"; 
+    LOG(INFO) << "Model computation (C++): " << elapsed.count() << "ms \n";
   }
 
   if(profile_ == true) {
-    LOG(INFO) << "Stopping profiler" << "\n";
-    profiler->StopProfiling();
-    auto profile_events = profiler->GetProfileEvents();
+    profiler_->StopProfiling();
+    auto profile_events = profiler_->GetProfileEvents();
     for(int i = 0; i < profile_events.size(); i++) {
-      LOG(INFO) << "Inside profiler loop" << "\n";
+      if(profile_events[i]->event_type != profiling::ProfileEvent::EventType::OPERATOR_INVOKE_EVENT) {
+        continue;
+      }
       auto op_index = profile_events[i]->event_metadata;
       const auto node_and_registration = interpreter->node_and_registration(op_index);
       const TfLiteRegistration registration = node_and_registration->second;
-      LOG(INFO) << std::fixed << std::setw(10) << std::setprecision(3)
-                << (profile_events[i]->end_timestamp_us - profile_events[i]->begin_timestamp_us) / 1000.0
-                << ", Node" << std::setw(3) << std::setprecision(3) << op_index
-                << ", OpCode" << std::setw(3) << std::setprecision(3)
-                << registration.builtin_code << ", "
-                << EnumNameBuiltinOperator(static_cast<BuiltinOperator>(registration.builtin_code))
-                << "\n";
+      const double ms = (profile_events[i]->end_timestamp_us - profile_events[i]->begin_timestamp_us) / 1000.0;
+      const char* op_name = registration.custom_name != nullptr
+                              ? registration.custom_name
+                              : EnumNameBuiltinOperator(static_cast<BuiltinOperator>(registration.builtin_code));
+      op_stats_.Record(op_index, registration.builtin_code, op_name, ms);
+      if(verbose_) {
+        LOG(INFO) << std::fixed << std::setw(10) << std::setprecision(3) << ms
+                  << ", Node" << std::setw(3) << std::setprecision(3) << op_index
+                  << ", OpCode" << std::setw(3) << std::setprecision(3)
+                  << registration.builtin_code << ", " << op_name << "\n";
+      }
     }
-    LOG(INFO) << "Displayed layer wise profiling information" << "\n" ;
+    profiler_->Reset();
   }
 
-  // read and store model predictions
-  int output = interpreter->outputs()[0];
-  TfLiteIntArray* output_dims = interpreter->tensor(output)->dims;
-  auto output_size = output_dims->data[output_dims->size-1];
-  pred_len_ = output_size;
-  
-  result_float_ = new float[output_size];
-  if(interpreter->tensor(output)->type == kTfLiteFloat32) {
-    float* prediction = interpreter->typed_output_tensor<float>(0);
-    for(int i = 0; i < output_size; i++)
-      result_float_[i] = prediction[i]; 
-  }	else if(interpreter->tensor(output)->type == kTfLiteUInt8) {
-    uint8_t* prediction = interpreter->typed_output_tensor<uint8_t>(0);
-    for(int i = 0; i < output_size; i++)
-      result_float_[i] = prediction[i] / 255.0; 
-  } else if(interpreter->tensor(output)->type == kTfLiteInt8) {
-    int8_t* prediction = interpreter->typed_output_tensor<int8_t>(0);
+  if(result_cache_ != nullptr) {
+    result_cache_->Insert(cache_key, OutputTensors());
+  }
+}
+
+// Hash of every input tensor, seeded with the model hash
+uint64_t Predictor::InputHash() {
+  uint64_t hash = model_hash_;
+  for(int index : interpreter->inputs()) {
+    const TfLiteTensor* tensor = interpreter->tensor(index);
+    hash = XXH64(tensor->data.raw, tensor->bytes, hash);
+  }
+  return hash;
+}
+
+std::vector<TfLiteTensor*> Predictor::OutputTensors() {
+  std::vector<TfLiteTensor*> tensors;
+  for(int index : interpreter->outputs()) {
+    tensors.push_back(interpreter->tensor(index));
+  }
+  return tensors;
+}
+
+// Shares `cache` (null to disable) between this predictor and any other
+// predictor on the same model, such as the instances of a pool
+void Predictor::SetResultCache(std::shared_ptr<ResultCache> cache, uint64_t model_hash) {
+  result_cache_ = cache;
+  model_hash_ = model_hash;
+}
+
+// The first two invokes of a session are kept apart: the first one pays for
+// lazy kernel preparation and delegate compilation, the second one shows
+// whether the predictor has reached steady state
+void Predictor::RecordStartupInvoke(double ms) {
+  if(invokes_ == 0) {
+    startup_.first_invoke_ms = ms;
+  } else if(invokes_ == 1) {
+    startup_.warm_invoke_ms = ms;
+  }
+  invokes_++;
+}
+
+// Runs `invokes` inferences on zeroed input so that the first real request
+// is served at steady-state latency. Warm-up runs are left out of the stage
+// and operator statistics.
+void Predictor::Warmup(int invokes) {
+  TfLiteTensor* input = interpreter->tensor(input_);
+  for(int i = 0; i < invokes; i++) {
+    memset(input->data.raw, 0, input->bytes);
+    const auto start_time = steady_clock::now();
+    if(!InvokeInterpreter()) {
+      LOG(FATAL) << "Failed to invoke tflite" << "\n";
+      return;
+    }
+    const std::chrono::duration<double, std::milli> elapsed = steady_clock::now() - start_time;
+    RecordStartupInvoke(elapsed.count());
+    startup_.warmup_invokes++;
+  }
+}
+
+// Dequantizes a uint8/int8 tensor with its own scale and zero point. Tensors
+// without quantization parameters keep the historic [0, 1] mapping.
+template <typename T>
+static void Dequantize(const TfLiteTensor* tensor, const T* prediction, float* out, int size) {
+  float scale = tensor->params.scale;
+  int zero_point = tensor->params.zero_point;
+  if(scale == 0) {
+    scale = 1 / 255.0;
+    zero_point = 0;
+  }
+  for(int i = 0; i < size; i++)
+    out[i] = (prediction[i] - zero_point) * scale;
+}
+
+// Reads every output tensor of the last Invoke into its float buffer
+void Predictor::ReadOutput() {
+  const auto start_time = steady_clock::now();
+  const int num_outputs = outputs_.size();
+  for(int index = 0; index < num_outputs; index++) {
+    const TfLiteTensor* tensor = interpreter->tensor(interpreter->outputs()[index]);
+    ConvertOutput(index, tensor->data.raw, Output(index));
+  }
+  outputs_stale_ = false;
+  stage_stats_.Record(PREDICTOR_STAGE_DEQUANTIZE, start_time);
+}
+
+void Predictor::DeferOutputs() {
+  outputs_stale_ = true;
+  for(float* buffer : caller_outputs_) {
+    if(buffer != nullptr) {
+      ReadOutput();
+      return;
+    }
+  }
+}
+
+void Predictor::SyncOutputs() {
+  if(outputs_stale_) {
+    ReadOutput();
+  }
+}
+
+// Converts raw, a copy of output tensor `index`, to OutputLen(index) floats
+void Predictor::ConvertOutput(int index, const void* raw, float* out) {
+  const TfLiteTensor* tensor = interpreter->tensor(interpreter->outputs()[index]);
+  const int output_size = outputs_[index].size();
+  if(tensor->type == kTfLiteFloat32) {
+    memcpy(out, raw, output_size * sizeof(float));
+  } else if(tensor->type == kTfLiteUInt8) {
+    Dequantize(tensor, static_cast<const uint8_t*>(raw), out, output_size);
+  } else if(tensor->type == kTfLiteInt8) {
+    Dequantize(tensor, static_cast<const int8_t*>(raw), out, output_size);
+  } else if(tensor->type == kTfLiteInt32) {
+    const int32_t* values = static_cast<const int32_t*>(raw);
     for(int i = 0; i < output_size; i++)
-      result_float_[i] = prediction[i] / 255.0;
+      out[i] = values[i];
   } else {
-    LOG(FATAL) << "Unsupported output type: " << interpreter->tensor(output)->type << "\n";
+    LOG(FATAL) << "Unsupported output type: " << tensor->type << "\n";
+  }
+}
+
+// Min-heap order on (value, index): the weakest candidate sits at the front.
+// Equal values prefer the lower class index.
+static bool WeakerCandidate(const std::pair<float, int> &a, const std::pair<float, int> &b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+template <typename T>
+static void SelectTopK(const T* row, int len, int k, std::vector<std::pair<float, int>> &heap) {
+  heap.clear();
+  for(int i = 0; i < len; i++) {
+    const float value = row[i];
+    if((int)heap.size() < k) {
+      heap.emplace_back(value, i);
+      std::push_heap(heap.begin(), heap.end(), WeakerCandidate);
+    } else if(value > heap.front().first) {
+      std::pop_heap(heap.begin(), heap.end(), WeakerCandidate);
+      heap.back() = std::make_pair(value, i);
+      std::push_heap(heap.begin(), heap.end(), WeakerCandidate);
+    }
+  }
+  // best first
+  std::sort_heap(heap.begin(), heap.end(), WeakerCandidate);
+}
+
+int Predictor::TopK(int k, int* indices, float* scores) {
+  return TopK(interpreter->tensor(output_)->data.raw, k, indices, scores, topk_heap_);
+}
+
+// TopK over raw, a copy of output 0, using the caller's scratch heap
+int Predictor::TopK(const void* raw, int k, int* indices, float* scores, std::vector<std::pair<float, int>> &heap) {
+  k = std::min(k, pred_len_);
+  if(k < 1) {
+    return 0;
+  }
+  const auto start_time = steady_clock::now();
+  const TfLiteTensor* tensor = interpreter->tensor(output_);
+  float scale = tensor->params.scale;
+  int zero_point = tensor->params.zero_point;
+  if(scale == 0) {
+    scale = 1 / 255.0;
+    zero_point = 0;
+  }
+  heap.reserve(k);
+  for(int b = 0; b < batch_; b++) {
+    const int offset = b * pred_len_;
+    switch(tensor->type) {
+      case kTfLiteFloat32:
+        SelectTopK(static_cast<const float*>(raw) + offset, pred_len_, k, heap);
+        break;
+      case kTfLiteUInt8:
+        SelectTopK(static_cast<const uint8_t*>(raw) + offset, pred_len_, k, heap);
+        break;
+      case kTfLiteInt8:
+        SelectTopK(static_cast<const int8_t*>(raw) + offset, pred_len_, k, heap);
+        break;
+      default:
+        LOG(FATAL) << "Unsupported output type: " << tensor->type << "\n";
+        return 0;
+    }
+    for(int i = 0; i < k; i++) {
+      indices[b * k + i] = heap[i].second;
+      scores[b * k + i] = tensor->type == kTfLiteFloat32
+                            ? heap[i].first
+                            : (heap[i].first - zero_point) * scale;
+    }
+  }
+  stage_stats_.Record(PREDICTOR_STAGE_TOPK, start_time);
+  return k;
+}
+
+int Predictor::LoadLabels(const string &label_file) {
+  std::ifstream file(label_file);
+  if(!file) {
+    LOG(FATAL) << "Failed to open label file " << label_file << "\n";
+    return -1;
+  }
+  labels_.clear();
+  string line;
+  while(std::getline(file, line)) {
+    labels_.push_back(line);
+  }
+  return labels_.size();
+}
+
+const char* Predictor::Label(int index) {
+  if(index < 0 || index >= (int)labels_.size()) {
+    return "";
   }
+  return labels_[index].c_str();
 }
 
 PredictorContext NewTflite(char *model_file, int batch, int mode, bool verbose, bool profile) {
+  return NewTfliteWarm(model_file, batch, mode, verbose, profile, 0);
+}
+
+PredictorContext NewTfliteWarm(char *model_file, int batch, int mode, bool verbose, bool profile, int warmup_invokes) {
   try {
     const auto ctx = new Predictor(model_file, batch, mode, verbose, profile);
+    ctx->Warmup(warmup_invokes);
     return (void *) ctx;
   } catch(const std::invalid_argument &ex) {
     errno = EINVAL;
@@ -299,6 +866,20 @@ PredictorContext NewTflite(char *model_file, int batch, int mode, bool verbose,
 
 void InitTflite() {}
 
+int SetAffinityTflite(PredictorContext pred, int* cpus, int n) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || n < 0 || (n > 0 && cpus == nullptr)) {
+    return -1;
+  }
+  for(int i = 0; i < n; i++) {
+    if(cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+      return -1;
+    }
+  }
+  predictor->SetAffinity(std::vector<int>(cpus, cpus + n));
+  return 0;
+}
+
 void PredictTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize) {
   auto predictor = (Predictor *)pred;
   if (predictor == nullptr) {
@@ -308,11 +889,116 @@ void PredictTflite(PredictorContext pred, int* inputData_quantize, float* inputD
   return;
 }
 
+static bool ValidGeometry(const ImageGeometry* geometry) {
+  if (geometry->height < 1 || geometry->width < 1 || geometry->channels < 1 ||
+      (geometry->layout != PREDICTOR_LAYOUT_HWC && geometry->layout != PREDICTOR_LAYOUT_CHW)) {
+    LOG(FATAL) << "Invalid image geometry " << geometry->height << "x" << geometry->width
+               << "x" << geometry->channels << ", layout " << geometry->layout << "\n";
+    return false;
+  }
+  return true;
+}
+
+void PredictImageTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize, const ImageGeometry* geometry) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || geometry == nullptr || !ValidGeometry(geometry)) {
+    return;
+  }
+  predictor->Predict(inputData_quantize, inputData_float, quantize, *geometry);
+}
+
+int SetNormalizationTflite(PredictorContext pred, const float* mean, const float* scale, int channels) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || (mean == nullptr) != (scale == nullptr) ||
+      (mean != nullptr && (channels < 1 || channels > 4))) {
+    return -1;
+  }
+  Normalization norm;
+  for(int c = 0; mean != nullptr && c < 4; c++) {
+    norm.mean[c] = mean[c % channels];
+    norm.scale[c] = scale[c % channels];
+  }
+  predictor->input_norm_ = norm;
+  predictor->normalize_ = mean != nullptr;
+  return 0;
+}
+
+void PredictUInt8Tflite(PredictorContext pred, uint8_t* images, const ImageGeometry* geometry) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || images == nullptr || geometry == nullptr || !ValidGeometry(geometry)) {
+    return;
+  }
+  const int image_size = geometry->height * geometry->width * geometry->channels;
+  for(int b = 0; b < predictor->batch_; b++) {
+    predictor->FillInputUInt8(b, images + b * image_size, *geometry);
+  }
+  predictor->Invoke();
+  predictor->DeferOutputs();
+}
+
+// Fills in the layout of every output, returns the floats they need
+static size_t DescribeOutputs(Predictor* predictor, PredictResult* result) {
+  const std::vector<int> &outputs = predictor->interpreter->outputs();
+  result->num_outputs = outputs.size();
+  size_t total_len = 0;
+  for(int index = 0; index < (int)outputs.size(); index++) {
+    const size_t len = predictor->OutputLen(index);
+    if(index < PREDICTOR_MAX_OUTPUTS) {
+      const TfLiteIntArray* dims = predictor->interpreter->tensor(outputs[index])->dims;
+      result->offset[index] = total_len;
+      result->len[index] = len;
+      result->num_dims[index] = std::min(dims->size, PREDICTOR_MAX_DIMS);
+      for(int d = 0; d < result->num_dims[index]; d++) {
+        result->dims[index][d] = dims->data[d];
+      }
+    }
+    total_len += len;
+  }
+  result->total_len = total_len;
+  return total_len;
+}
+
+int PredictIntoTflite(PredictorContext pred, int* inputData_quantize, float* inputData_float, bool quantize,
+                      const ImageGeometry* geometry, int batch, float* out, size_t out_len, PredictResult* result) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || geometry == nullptr || result == nullptr || !ValidGeometry(geometry)) {
+    return -1;
+  }
+  if(batch != predictor->batch_) {
+    LOG(FATAL) << "Got " << batch << " images for batch size " << predictor->batch_ << "\n";
+    return -1;
+  }
+  if(DescribeOutputs(predictor, result) > out_len || out == nullptr) {
+    return -1;
+  }
+  const int image_size = geometry->height * geometry->width * geometry->channels;
+  for(int b = 0; b < predictor->batch_; b++) {
+    predictor->FillInput(b,
+                         inputData_quantize ? inputData_quantize + b * image_size : nullptr,
+                         inputData_float ? inputData_float + b * image_size : nullptr,
+                         quantize, *geometry);
+  }
+  predictor->Invoke();
+
+  const auto start_time = steady_clock::now();
+  const std::vector<int> &outputs = predictor->interpreter->outputs();
+  float* output = out;
+  for(int index = 0; index < (int)outputs.size(); index++) {
+    predictor->ConvertOutput(index, predictor->interpreter->tensor(outputs[index])->data.raw, output);
+    output += predictor->OutputLen(index);
+  }
+  predictor->stage_stats_.Record(PREDICTOR_STAGE_DEQUANTIZE, start_time);
+  // the predictor's own float outputs now lag behind
+  predictor->DeferOutputs();
+  return 0;
+}
+
 float* GetPredictionsTflite(PredictorContext pred) {
   auto predictor = (Predictor *)pred;
   if (predictor == nullptr) {
     return nullptr;
   }
+  predictor->SyncOutputs();
   return predictor->result_float_;
 }
 
@@ -356,175 +1042,276 @@ int GetPredLenTflite(PredictorContext pred) {
   return predictor->pred_len_;
 }
 
-void SetInputTflite_float(float* out, float* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
-  
-  int number_of_pixels = image_height * image_width * image_channels;
-  
-  // create  a new interpreter to resize input image into model's desired dimensions
-  std::unique_ptr<Interpreter> interpreter(new Interpreter);
-  int base_index = 0;
-  // two inputs: input and new_sizes
-  interpreter->AddTensors(2, &base_index);
-  // one output
-  interpreter->AddTensors(1, &base_index);
-  // set input and output tensors
-  interpreter->SetInputs({0, 1});
-  interpreter->SetOutputs({2});
-
-  // set parameters of tensors
-  TfLiteQuantizationParams quant;
-  interpreter->SetTensorParametersReadWrite(
-      0, kTfLiteFloat32, "input",
-      {1, image_height, image_width, image_channels}, quant);
-  interpreter->SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2},
-                                            quant);
-  interpreter->SetTensorParametersReadWrite(
-      2, kTfLiteFloat32, "output",
-      {1, model_height, model_width, model_channels}, quant);
-
-  ops::builtin::BuiltinOpResolver resolver;
-  const TfLiteRegistration* resize_op =
-      resolver.FindOp(BuiltinOperator_RESIZE_BILINEAR, 1);
-  auto* params = reinterpret_cast<TfLiteResizeBilinearParams*>(
-      malloc(sizeof(TfLiteResizeBilinearParams)));
-  params->align_corners = false;
-  interpreter->AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op,
-                                     nullptr);
-
-  interpreter->AllocateTensors();
-
-  // fill input image
-  auto input = interpreter->typed_tensor<float>(0);
-  for (int i = 0; i < number_of_pixels; i++) {
-    input[i] = in[i];
-  }
-
-  // fill new_sizes
-  interpreter->typed_tensor<int>(1)[0] = model_height;
-  interpreter->typed_tensor<int>(1)[1] = model_width;
-
-  interpreter->Invoke();
-
-  auto output = interpreter->typed_tensor<float>(2);
-  auto output_number_of_pixels = model_height * model_width * model_channels;
-
-  for (int i = 0; i < output_number_of_pixels; i++) {
-      out[i] = output[i];
+// Fills info from tensor; returns -1 when the tensor has too many dimensions
+static int GetTensorInfo(TfLiteTensor* tensor, PredictorTensorInfo* info) {
+  if(tensor->dims->size > PREDICTOR_MAX_DIMS) {
+    return -1;
+  }
+  info->name = tensor->name;
+  info->data = tensor->data.raw;
+  info->type = tensor->type;
+  info->num_dims = tensor->dims->size;
+  for(int i = 0; i < tensor->dims->size; i++) {
+    info->dims[i] = tensor->dims->data[i];
   }
+  info->bytes = tensor->bytes;
+  info->scale = tensor->params.scale;
+  info->zero_point = tensor->params.zero_point;
+  return 0;
 }
 
-void SetInputTflite_quantize_8_unsigned(uint8_t* out, int* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
-  
-  int number_of_pixels = image_height * image_width * image_channels;
-  
-  // create  a new interpreter to resize input image into model's desired dimensions
-  std::unique_ptr<Interpreter> interpreter(new Interpreter);
-  int base_index = 0;
-  // two inputs: input and new_sizes
-  interpreter->AddTensors(2, &base_index);
-  // one output
-  interpreter->AddTensors(1, &base_index);
-  // set input and output tensors
-  interpreter->SetInputs({0, 1});
-  interpreter->SetOutputs({2});
+int GetInputTensorTflite(PredictorContext pred, PredictorTensorInfo* info) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || info == nullptr) {
+    return -1;
+  }
+  return GetTensorInfo(predictor->interpreter->tensor(predictor->input_), info);
+}
 
-  // set parameters of tensors
-  TfLiteQuantizationParams quant;
-  interpreter->SetTensorParametersReadWrite(
-      0, kTfLiteFloat32, "input",
-      {1, image_height, image_width, image_channels}, quant);
-  interpreter->SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2},
-                                            quant);
-  interpreter->SetTensorParametersReadWrite(
-      2, kTfLiteFloat32, "output",
-      {1, model_height, model_width, model_channels}, quant);
+int GetInputCountTflite(PredictorContext pred) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return 0;
+  }
+  return predictor->interpreter->inputs().size();
+}
+
+int GetInputTensorAtTflite(PredictorContext pred, int index, PredictorTensorInfo* info) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || info == nullptr || index < 0 || index >= GetInputCountTflite(pred)) {
+    return -1;
+  }
+  return GetTensorInfo(predictor->interpreter->tensor(predictor->interpreter->inputs()[index]), info);
+}
 
-  ops::builtin::BuiltinOpResolver resolver;
-  const TfLiteRegistration* resize_op =
-      resolver.FindOp(BuiltinOperator_RESIZE_BILINEAR, 1);
-  auto* params = reinterpret_cast<TfLiteResizeBilinearParams*>(
-      malloc(sizeof(TfLiteResizeBilinearParams)));
-  params->align_corners = false;
-  interpreter->AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op,
-                                     nullptr);
+static int FindTensor(Predictor* predictor, const std::vector<int> &tensors, const char* name) {
+  for(int i = 0; i < (int)tensors.size(); i++) {
+    const char* tensor_name = predictor->interpreter->tensor(tensors[i])->name;
+    if(tensor_name != nullptr && strcmp(tensor_name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
 
-  interpreter->AllocateTensors();
+int FindInputTflite(PredictorContext pred, char* name) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || name == nullptr) {
+    return -1;
+  }
+  return FindTensor(predictor, predictor->interpreter->inputs(), name);
+}
 
-  // fill input image
-  auto input = interpreter->typed_tensor<float>(0);
-  for (int i = 0; i < number_of_pixels; i++) {
-    input[i] = in[i];
+int FindOutputTflite(PredictorContext pred, char* name) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || name == nullptr) {
+    return -1;
   }
+  return FindTensor(predictor, predictor->interpreter->outputs(), name);
+}
 
-  // fill new_sizes
-  interpreter->typed_tensor<int>(1)[0] = model_height;
-  interpreter->typed_tensor<int>(1)[1] = model_width;
+int ResizeInputTflite(PredictorContext pred, int index, int* dims, int num_dims) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || dims == nullptr || index < 0 || index >= GetInputCountTflite(pred) ||
+      num_dims < 1 || num_dims > PREDICTOR_MAX_DIMS) {
+    return -1;
+  }
+  return predictor->ResizeInput(index, std::vector<int>(dims, dims + num_dims)) ? 0 : -1;
+}
 
-  interpreter->Invoke();
+void SetReadOutputsTflite(PredictorContext pred, bool read_outputs) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
+  }
+  predictor->read_outputs_ = read_outputs;
+}
 
-  auto output = interpreter->typed_tensor<float>(2);
-  auto output_number_of_pixels = model_height * model_width * model_channels;
+void InvokeTflite(PredictorContext pred) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
+  }
+  predictor->Invoke();
+  if(predictor->read_outputs_) {
+    predictor->DeferOutputs();
+  }
+}
 
-  for (int i = 0; i < output_number_of_pixels; i++) {
-      out[i] = (uint8_t)output[i];
+int GetOutputCountTflite(PredictorContext pred) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return 0;
   }
+  return predictor->interpreter->outputs().size();
 }
 
+int GetOutputLenTflite(PredictorContext pred, int index) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || index < 0 || index >= GetOutputCountTflite(pred)) {
+    return 0;
+  }
+  return predictor->OutputLen(index);
+}
 
-void SetInputTflite_quantize_8_signed(int8_t* out, int* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
-  
-  int number_of_pixels = image_height * image_width * image_channels;
-  
-  // create  a new interpreter to resize input image into model's desired dimensions
-  std::unique_ptr<Interpreter> interpreter(new Interpreter);
-  int base_index = 0;
-  // two inputs: input and new_sizes
-  interpreter->AddTensors(2, &base_index);
-  // one output
-  interpreter->AddTensors(1, &base_index);
-  // set input and output tensors
-  interpreter->SetInputs({0, 1});
-  interpreter->SetOutputs({2});
-
-  // set parameters of tensors
-  TfLiteQuantizationParams quant;
-  interpreter->SetTensorParametersReadWrite(
-      0, kTfLiteFloat32, "input",
-      {1, image_height, image_width, image_channels}, quant);
-  interpreter->SetTensorParametersReadWrite(1, kTfLiteInt32, "new_size", {2},
-                                            quant);
-  interpreter->SetTensorParametersReadWrite(
-      2, kTfLiteFloat32, "output",
-      {1, model_height, model_width, model_channels}, quant);
-
-  ops::builtin::BuiltinOpResolver resolver;
-  const TfLiteRegistration* resize_op =
-      resolver.FindOp(BuiltinOperator_RESIZE_BILINEAR, 1);
-  auto* params = reinterpret_cast<TfLiteResizeBilinearParams*>(
-      malloc(sizeof(TfLiteResizeBilinearParams)));
-  params->align_corners = false;
-  interpreter->AddNodeWithParameters({0, 1}, {2}, nullptr, 0, params, resize_op,
-                                     nullptr);
-
-  interpreter->AllocateTensors();
-
-  // fill input image
-  auto input = interpreter->typed_tensor<float>(0);
-  for (int i = 0; i < number_of_pixels; i++) {
-    input[i] = in[i];
-  }
-
-  // fill new_sizes
-  interpreter->typed_tensor<int>(1)[0] = model_height;
-  interpreter->typed_tensor<int>(1)[1] = model_width;
-
-  interpreter->Invoke();
-
-  auto output = interpreter->typed_tensor<float>(2);
-  auto output_number_of_pixels = model_height * model_width * model_channels;
-
-  for (int i = 0; i < output_number_of_pixels; i++) {
-      out[i] = (int8_t)output[i];
+float* GetOutputTflite(PredictorContext pred, int index) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || index < 0 || index >= GetOutputCountTflite(pred)) {
+    return nullptr;
+  }
+  predictor->SyncOutputs();
+  return predictor->Output(index);
+}
+
+int GetOutputTensorTflite(PredictorContext pred, int index, PredictorTensorInfo* info) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || info == nullptr || index < 0 || index >= GetOutputCountTflite(pred)) {
+    return -1;
+  }
+  return GetTensorInfo(predictor->interpreter->tensor(predictor->interpreter->outputs()[index]), info);
+}
+
+void SetOutputBufferTflite(PredictorContext pred, int index, float* buffer) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || index < 0 || index >= GetOutputCountTflite(pred)) {
+    return;
+  }
+  predictor->SetOutputBuffer(index, buffer);
+}
+
+int GetTopKTflite(PredictorContext pred, int k, int batch, int* indices, float* scores) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || indices == nullptr || scores == nullptr || batch < predictor->batch_) {
+    return 0;
+  }
+  return predictor->TopK(k, indices, scores);
+}
+
+int LoadLabelsTflite(PredictorContext pred, char* label_file) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || label_file == nullptr) {
+    return -1;
+  }
+  return predictor->LoadLabels(label_file);
+}
+
+const char* GetLabelTflite(PredictorContext pred, int index) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return "";
+  }
+  return predictor->Label(index);
+}
+
+int GetOpProfileTflite(PredictorContext pred, OpProfile* out, int max, bool by_op_type) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return 0;
+  }
+  return predictor->op_stats_.Export(out, max, by_op_type);
+}
+
+int DumpOpProfileTflite(PredictorContext pred, char* path, int format) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || path == nullptr) {
+    return -1;
+  }
+  return predictor->op_stats_.Dump(path, format) ? 0 : -1;
+}
+
+void ResetOpProfileTflite(PredictorContext pred) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
+  }
+  predictor->op_stats_.Reset();
+}
+
+void WarmupTflite(PredictorContext pred, int invokes) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
+  }
+  predictor->Warmup(invokes);
+}
+
+void GetStartupStatsTflite(PredictorContext pred, StartupStats* stats) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
+  }
+  *stats = predictor->startup_;
+}
+
+int EnableResultCacheTflite(PredictorContext pred, size_t capacity_bytes) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return -1;
+  }
+  if(capacity_bytes == 0) {
+    predictor->SetResultCache(nullptr, 0);
+  } else {
+    predictor->SetResultCache(std::make_shared<ResultCache>(capacity_bytes), ModelHash(*predictor->net_));
+  }
+  return 0;
+}
+
+void GetResultCacheStatsTflite(PredictorContext pred, ResultCacheStats* stats) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr || stats == nullptr) {
+    return;
+  }
+  if(predictor->result_cache_ == nullptr) {
+    memset(stats, 0, sizeof(ResultCacheStats));
+    return;
+  }
+  predictor->result_cache_->Stats(stats);
+}
+
+int GetStatsTflite(PredictorContext pred, StageStats* out, int max) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return 0;
+  }
+  return predictor->stage_stats_.Export(out, max);
+}
+
+void ResetStatsTflite(PredictorContext pred) {
+  auto predictor = (Predictor *)pred;
+  if (predictor == nullptr) {
+    return;
   }
+  predictor->stage_stats_.Reset();
+}
+
+// The helpers below resize a 32-bit source image into the model's input
+// geometry with the native preprocessing kernels (see preprocess.cpp).
+
+void SetInputTflite_float(float* out, float* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
+  ResizePlan plan;
+  BuildResizePlan(image_height, image_width, model_height, model_width, &plan);
+  SourceFormat format;
+  format.type = kSourceFloat32;
+  format.channels = image_channels;
+  ResizeImage(in, format, out, kTargetFloat32, model_channels, plan, Normalization());
 }
 
+void SetInputTflite_quantize_8_unsigned(uint8_t* out, int* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
+  ResizePlan plan;
+  BuildResizePlan(image_height, image_width, model_height, model_width, &plan);
+  SourceFormat format;
+  format.channels = image_channels;
+  ResizeImage(in, format, out, kTargetUInt8, model_channels, plan, Normalization());
+}
+
+void SetInputTflite_quantize_8_signed(int8_t* out, int* in, int image_height, int image_width, int image_channels, int model_height, int model_width, int model_channels) {
+  ResizePlan plan;
+  BuildResizePlan(image_height, image_width, model_height, model_width, &plan);
+  SourceFormat format;
+  format.channels = image_channels;
+  // pixel values, offset by -128 like every other int8 input path
+  ResizeImage(in, format, out, kTargetUInt8, model_channels, plan, Normalization());
+  QuantTable table;
+  BuildQuantTable(kTargetInt8, &table);
+  QuantizeImage((const uint8_t*)out, model_height * model_width, model_channels, out, table);
+}
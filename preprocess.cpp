@@ -0,0 +1,484 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PREPROCESS_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define PREPROCESS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "preprocess.hpp"
+
+void BuildResizePlan(int src_height, int src_width, int dst_height, int dst_width, ResizePlan* plan) {
+  plan->src_height = src_height;
+  plan->src_width = src_width;
+  plan->dst_height = dst_height;
+  plan->dst_width = dst_width;
+
+  // align_corners = false: output pixel i samples input position i * in / out
+  const float height_scale = (float)src_height / dst_height;
+  const float width_scale = (float)src_width / dst_width;
+
+  plan->y0.resize(dst_height);
+  plan->y1.resize(dst_height);
+  plan->fy.resize(dst_height);
+  for(int y = 0; y < dst_height; y++) {
+    const float in = y * height_scale;
+    const int y0 = std::min((int)std::floor(in), src_height - 1);
+    plan->y0[y] = y0;
+    plan->y1[y] = std::min(y0 + 1, src_height - 1);
+    plan->fy[y] = in - y0;
+  }
+  plan->wy.resize(dst_height);
+  for(int y = 0; y < dst_height; y++) {
+    plan->wy[y] = (int)std::lrint(plan->fy[y] * (1 << kResizeWeightBits));
+  }
+
+  plan->x0.resize(dst_width);
+  plan->x1.resize(dst_width);
+  plan->fx.resize(dst_width);
+  for(int x = 0; x < dst_width; x++) {
+    const float in = x * width_scale;
+    const int x0 = std::min((int)std::floor(in), src_width - 1);
+    plan->x0[x] = x0;
+    plan->x1[x] = std::min(x0 + 1, src_width - 1);
+    plan->fx[x] = in - x0;
+  }
+  plan->wx.resize(dst_width);
+  for(int x = 0; x < dst_width; x++) {
+    plan->wx[x] = (int)std::lrint(plan->fx[x] * (1 << kResizeWeightBits));
+  }
+}
+
+namespace {
+
+// Row kernels. blend: out = top + (bottom - top) * weight.
+// to_*: out = (in - mean) * scale, converted to the target type.
+struct RowKernels {
+  const char* name;
+  void (*blend)(const float* top, const float* bottom, float weight, float* out, int n);
+  void (*to_float)(const float* in, const float* mean, const float* scale, float* out, int n);
+  void (*to_uint8)(const float* in, const float* mean, const float* scale, uint8_t* out, int n);
+  void (*to_int8)(const float* in, const float* mean, const float* scale, int8_t* out, int n);
+};
+
+inline int RoundClamp(float v, float lo, float hi) {
+  return (int)std::lrint(std::min(std::max(v, lo), hi));
+}
+
+void BlendScalar(const float* top, const float* bottom, float weight, float* out, int n) {
+  for(int i = 0; i < n; i++) {
+    out[i] = top[i] + (bottom[i] - top[i]) * weight;
+  }
+}
+
+void ToFloatScalar(const float* in, const float* mean, const float* scale, float* out, int n) {
+  for(int i = 0; i < n; i++) {
+    out[i] = (in[i] - mean[i]) * scale[i];
+  }
+}
+
+void ToUInt8Scalar(const float* in, const float* mean, const float* scale, uint8_t* out, int n) {
+  for(int i = 0; i < n; i++) {
+    out[i] = (uint8_t)RoundClamp((in[i] - mean[i]) * scale[i], 0, 255);
+  }
+}
+
+void ToInt8Scalar(const float* in, const float* mean, const float* scale, int8_t* out, int n) {
+  for(int i = 0; i < n; i++) {
+    out[i] = (int8_t)RoundClamp((in[i] - mean[i]) * scale[i], -128, 127);
+  }
+}
+
+const RowKernels kScalarKernels = {"scalar", BlendScalar, ToFloatScalar, ToUInt8Scalar, ToInt8Scalar};
+
+#ifdef PREPROCESS_X86
+
+__attribute__((target("avx2")))
+void BlendAvx2(const float* top, const float* bottom, float weight, float* out, int n) {
+  const __m256 w = _mm256_set1_ps(weight);
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    const __m256 t = _mm256_loadu_ps(top + i);
+    const __m256 b = _mm256_loadu_ps(bottom + i);
+    _mm256_storeu_ps(out + i, _mm256_add_ps(t, _mm256_mul_ps(_mm256_sub_ps(b, t), w)));
+  }
+  BlendScalar(top + i, bottom + i, weight, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void ToFloatAvx2(const float* in, const float* mean, const float* scale, float* out, int n) {
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    const __m256 v = _mm256_sub_ps(_mm256_loadu_ps(in + i), _mm256_loadu_ps(mean + i));
+    _mm256_storeu_ps(out + i, _mm256_mul_ps(v, _mm256_loadu_ps(scale + i)));
+  }
+  ToFloatScalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+// normalizes and clamps 8 values, then rounds them to int32
+__attribute__((target("avx2")))
+inline __m256i NormalizeRoundAvx2(const float* in, const float* mean, const float* scale, __m256 lo, __m256 hi) {
+  __m256 v = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(in), _mm256_loadu_ps(mean)), _mm256_loadu_ps(scale));
+  v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+  return _mm256_cvtps_epi32(v);
+}
+
+__attribute__((target("avx2")))
+void ToUInt8Avx2(const float* in, const float* mean, const float* scale, uint8_t* out, int n) {
+  const __m256 lo = _mm256_set1_ps(0);
+  const __m256 hi = _mm256_set1_ps(255);
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    const __m256i v = NormalizeRoundAvx2(in + i, mean + i, scale + i, lo, hi);
+    const __m128i v16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(v16, v16));
+  }
+  ToUInt8Scalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void ToInt8Avx2(const float* in, const float* mean, const float* scale, int8_t* out, int n) {
+  const __m256 lo = _mm256_set1_ps(-128);
+  const __m256 hi = _mm256_set1_ps(127);
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    const __m256i v = NormalizeRoundAvx2(in + i, mean + i, scale + i, lo, hi);
+    const __m128i v16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i*)(out + i), _mm_packs_epi16(v16, v16));
+  }
+  ToInt8Scalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+const RowKernels kAvx2Kernels = {"avx2", BlendAvx2, ToFloatAvx2, ToUInt8Avx2, ToInt8Avx2};
+
+#endif  // PREPROCESS_X86
+
+#ifdef PREPROCESS_NEON
+
+void BlendNeon(const float* top, const float* bottom, float weight, float* out, int n) {
+  const float32x4_t w = vdupq_n_f32(weight);
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    const float32x4_t t = vld1q_f32(top + i);
+    const float32x4_t b = vld1q_f32(bottom + i);
+    vst1q_f32(out + i, vmlaq_f32(t, vsubq_f32(b, t), w));
+  }
+  BlendScalar(top + i, bottom + i, weight, out + i, n - i);
+}
+
+void ToFloatNeon(const float* in, const float* mean, const float* scale, float* out, int n) {
+  int i = 0;
+  for(; i + 4 <= n; i += 4) {
+    const float32x4_t v = vsubq_f32(vld1q_f32(in + i), vld1q_f32(mean + i));
+    vst1q_f32(out + i, vmulq_f32(v, vld1q_f32(scale + i)));
+  }
+  ToFloatScalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+// normalizes and clamps 8 values, then rounds them to int16
+inline int16x8_t NormalizeRoundNeon(const float* in, const float* mean, const float* scale, float32x4_t lo, float32x4_t hi) {
+  float32x4_t a = vmulq_f32(vsubq_f32(vld1q_f32(in), vld1q_f32(mean)), vld1q_f32(scale));
+  float32x4_t b = vmulq_f32(vsubq_f32(vld1q_f32(in + 4), vld1q_f32(mean + 4)), vld1q_f32(scale + 4));
+  a = vminq_f32(vmaxq_f32(a, lo), hi);
+  b = vminq_f32(vmaxq_f32(b, lo), hi);
+  return vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a)), vqmovn_s32(vcvtnq_s32_f32(b)));
+}
+
+void ToUInt8Neon(const float* in, const float* mean, const float* scale, uint8_t* out, int n) {
+  const float32x4_t lo = vdupq_n_f32(0);
+  const float32x4_t hi = vdupq_n_f32(255);
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    vst1_u8(out + i, vqmovun_s16(NormalizeRoundNeon(in + i, mean + i, scale + i, lo, hi)));
+  }
+  ToUInt8Scalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+void ToInt8Neon(const float* in, const float* mean, const float* scale, int8_t* out, int n) {
+  const float32x4_t lo = vdupq_n_f32(-128);
+  const float32x4_t hi = vdupq_n_f32(127);
+  int i = 0;
+  for(; i + 8 <= n; i += 8) {
+    vst1_s8(out + i, vqmovn_s16(NormalizeRoundNeon(in + i, mean + i, scale + i, lo, hi)));
+  }
+  ToInt8Scalar(in + i, mean + i, scale + i, out + i, n - i);
+}
+
+const RowKernels kNeonKernels = {"neon", BlendNeon, ToFloatNeon, ToUInt8Neon, ToInt8Neon};
+
+#endif  // PREPROCESS_NEON
+
+const RowKernels& SelectKernels() {
+#ifdef PREPROCESS_X86
+  if(__builtin_cpu_supports("avx2")) {
+    return kAvx2Kernels;
+  }
+#endif
+#ifdef PREPROCESS_NEON
+  return kNeonKernels;
+#endif
+  return kScalarKernels;
+}
+
+const RowKernels& Kernels() {
+  static const RowKernels& kernels = SelectKernels();
+  return kernels;
+}
+
+template <typename T>
+void GatherPlanarRow(const T* src, int row, int height, int width, int channels, float* out) {
+  for(int c = 0; c < channels; c++) {
+    const T* in = src + (c * height + row) * width;
+    for(int x = 0; x < width; x++) {
+      out[x * channels + c] = in[x];
+    }
+  }
+}
+
+// Converts source row `row` of a CHW image to interleaved float
+void LoadPlanarRow(const void* src, SourceType src_type, int row, int height, int width, int channels, float* out) {
+  switch(src_type) {
+    case kSourceFloat32:
+      GatherPlanarRow((const float*)src, row, height, width, channels, out);
+      break;
+    case kSourceInt32:
+      GatherPlanarRow((const int32_t*)src, row, height, width, channels, out);
+      break;
+    case kSourceUInt8:
+      GatherPlanarRow((const uint8_t*)src, row, height, width, channels, out);
+      break;
+  }
+}
+
+// Converts source row `row` of an HWC image to float
+void LoadRow(const void* src, SourceType src_type, int row, int row_size, float* out) {
+  const int offset = row * row_size;
+  switch(src_type) {
+    case kSourceFloat32:
+      memcpy(out, (const float*)src + offset, row_size * sizeof(float));
+      break;
+    case kSourceInt32: {
+      const int32_t* in = (const int32_t*)src + offset;
+      for(int i = 0; i < row_size; i++) {
+        out[i] = in[i];
+      }
+      break; }
+    case kSourceUInt8: {
+      const uint8_t* in = (const uint8_t*)src + offset;
+      for(int i = 0; i < row_size; i++) {
+        out[i] = in[i];
+      }
+      break; }
+  }
+}
+
+}  // namespace
+
+const char* PreprocessKernelName() {
+  return Kernels().name;
+}
+
+void ResizeImage(const void* src, const SourceFormat& format,
+                 void* dst, TargetType dst_type, int dst_channels,
+                 const ResizePlan& plan, const Normalization& norm) {
+  const RowKernels& kernels = Kernels();
+  const int src_channels = format.channels;
+  const int src_row_size = plan.src_width * src_channels;
+  const int dst_row_size = plan.dst_width * dst_channels;
+
+  // rows[r & 1] caches source row r: the two rows blended for one output row
+  // always differ in parity (or are the same row)
+  std::vector<float> rows(2 * src_row_size);
+  int cached[2] = {-1, -1};
+  std::vector<float> blended(src_row_size);
+  std::vector<float> resized(dst_row_size);
+  std::vector<float> mean(dst_row_size), scale(dst_row_size);
+  std::vector<int> channel(dst_channels);
+  for(int c = 0; c < dst_channels; c++) {
+    channel[c] = c % src_channels;
+    if(format.bgr && src_channels >= 3 && channel[c] < 3) {
+      channel[c] = 2 - channel[c];
+    }
+  }
+  const bool swap = format.bgr && src_channels >= 3;
+  for(int i = 0; i < dst_row_size; i++) {
+    mean[i] = norm.mean[(i % dst_channels) & 3];
+    scale[i] = norm.scale[(i % dst_channels) & 3];
+  }
+
+  for(int y = 0; y < plan.dst_height; y++) {
+    const int source_rows[2] = {plan.y0[y], plan.y1[y]};
+    for(int r : source_rows) {
+      if(cached[r & 1] != r) {
+        float* row = &rows[(r & 1) * src_row_size];
+        if(format.layout == kLayoutCHW) {
+          LoadPlanarRow(src, format.type, r, plan.src_height, plan.src_width, src_channels, row);
+        } else {
+          LoadRow(src, format.type, r, src_row_size, row);
+        }
+        cached[r & 1] = r;
+      }
+    }
+    kernels.blend(&rows[(source_rows[0] & 1) * src_row_size],
+                  &rows[(source_rows[1] & 1) * src_row_size],
+                  plan.fy[y], blended.data(), src_row_size);
+
+    // horizontal pass gathers two columns per output pixel
+    if(src_channels == 3 && dst_channels == 3 && !swap) {
+      for(int x = 0; x < plan.dst_width; x++) {
+        const float* left = &blended[plan.x0[x] * 3];
+        const float* right = &blended[plan.x1[x] * 3];
+        const float fx = plan.fx[x];
+        float* out = &resized[x * 3];
+        out[0] = left[0] + (right[0] - left[0]) * fx;
+        out[1] = left[1] + (right[1] - left[1]) * fx;
+        out[2] = left[2] + (right[2] - left[2]) * fx;
+      }
+    } else {
+      for(int x = 0; x < plan.dst_width; x++) {
+        const float* left = &blended[plan.x0[x] * src_channels];
+        const float* right = &blended[plan.x1[x] * src_channels];
+        const float fx = plan.fx[x];
+        float* out = &resized[x * dst_channels];
+        for(int c = 0; c < dst_channels; c++) {
+          out[c] = left[channel[c]] + (right[channel[c]] - left[channel[c]]) * fx;
+        }
+      }
+    }
+
+    switch(dst_type) {
+      case kTargetFloat32:
+        kernels.to_float(resized.data(), mean.data(), scale.data(), (float*)dst + y * dst_row_size, dst_row_size);
+        break;
+      case kTargetUInt8:
+        kernels.to_uint8(resized.data(), mean.data(), scale.data(), (uint8_t*)dst + y * dst_row_size, dst_row_size);
+        break;
+      case kTargetInt8:
+        kernels.to_int8(resized.data(), mean.data(), scale.data(), (int8_t*)dst + y * dst_row_size, dst_row_size);
+        break;
+    }
+  }
+}
+
+void BuildQuantTable(TargetType dst_type, QuantTable* table) {
+  const int offset = dst_type == kTargetInt8 ? -128 : 0;
+  for(int c = 0; c < 4; c++) {
+    for(int p = 0; p < 256; p++) {
+      table->value[c][p] = (uint8_t)(int8_t)(p + offset);
+    }
+  }
+}
+
+void ResizeImageQuantized(const uint8_t* src, const SourceFormat& format,
+                          void* dst, int dst_channels,
+                          const ResizePlan& plan, const QuantTable& table) {
+  const int src_channels = format.channels;
+  const int src_row_size = plan.src_width * src_channels;
+  const int one = 1 << kResizeWeightBits;
+  const int shift = 2 * kResizeWeightBits;
+
+  // CHW rows are interleaved into rows[r & 1] first, see ResizeImage
+  std::vector<uint8_t> rows(format.layout == kLayoutCHW ? 2 * src_row_size : 0);
+  int cached[2] = {-1, -1};
+  std::vector<uint16_t> blended(src_row_size);
+  std::vector<int> channel(dst_channels);
+  for(int c = 0; c < dst_channels; c++) {
+    channel[c] = c % src_channels;
+    if(format.bgr && src_channels >= 3 && channel[c] < 3) {
+      channel[c] = 2 - channel[c];
+    }
+  }
+  const bool swap = format.bgr && src_channels >= 3;
+
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  for(int y = 0; y < plan.dst_height; y++) {
+    const uint8_t* source_rows[2];
+    for(int i = 0; i < 2; i++) {
+      const int r = i == 0 ? plan.y0[y] : plan.y1[y];
+      if(format.layout == kLayoutCHW) {
+        uint8_t* row = &rows[(r & 1) * src_row_size];
+        if(cached[r & 1] != r) {
+          for(int c = 0; c < src_channels; c++) {
+            const uint8_t* in = src + (c * plan.src_height + r) * plan.src_width;
+            for(int x = 0; x < plan.src_width; x++) {
+              row[x * src_channels + c] = in[x];
+            }
+          }
+          cached[r & 1] = r;
+        }
+        source_rows[i] = row;
+      } else {
+        source_rows[i] = src + r * src_row_size;
+      }
+    }
+
+    // vertical pass in kResizeWeightBits (255 << 8 fits in 16 bits, so the
+    // loop vectorizes on 16 bit lanes), horizontal pass in twice that
+    const uint16_t wy = plan.wy[y];
+    const uint16_t wy_top = one - wy;
+    for(int i = 0; i < src_row_size; i++) {
+      blended[i] = source_rows[0][i] * wy_top + source_rows[1][i] * wy;
+    }
+    const int32_t round = 1 << (shift - 1);
+    if(src_channels == 3 && dst_channels == 3 && !swap) {
+      for(int x = 0; x < plan.dst_width; x++) {
+        const uint16_t* left = &blended[plan.x0[x] * 3];
+        const uint16_t* right = &blended[plan.x1[x] * 3];
+        const int wx = plan.wx[x];
+        out[0] = table.value[0][(left[0] * (one - wx) + right[0] * wx + round) >> shift];
+        out[1] = table.value[1][(left[1] * (one - wx) + right[1] * wx + round) >> shift];
+        out[2] = table.value[2][(left[2] * (one - wx) + right[2] * wx + round) >> shift];
+        out += 3;
+      }
+      continue;
+    }
+    for(int x = 0; x < plan.dst_width; x++) {
+      const uint16_t* left = &blended[plan.x0[x] * src_channels];
+      const uint16_t* right = &blended[plan.x1[x] * src_channels];
+      const int wx = plan.wx[x];
+      for(int c = 0; c < dst_channels; c++) {
+        const int32_t v = left[channel[c]] * (one - wx) + right[channel[c]] * wx;
+        *out++ = table.value[c & 3][(v + round) >> shift];
+      }
+    }
+  }
+}
+
+void QuantizeImage(const uint8_t* src, int pixels, int channels, void* dst, const QuantTable& table) {
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  if(channels == 3) {
+    for(int i = 0; i < pixels; i++) {
+      out[0] = table.value[0][src[0]];
+      out[1] = table.value[1][src[1]];
+      out[2] = table.value[2][src[2]];
+      src += 3;
+      out += 3;
+    }
+    return;
+  }
+  for(int i = 0; i < pixels; i++) {
+    for(int c = 0; c < channels; c++) {
+      *out++ = table.value[c & 3][*src++];
+    }
+  }
+}
+
+void QuantizeImage(const int* src, int pixels, int channels, void* dst, const QuantTable& table) {
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  for(int i = 0; i < pixels; i++) {
+    for(int c = 0; c < channels; c++) {
+      *out++ = table.value[c & 3][std::min(std::max(*src++, 0), 255)];
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <cstring>
+
+#include "result_cache.hpp"
+
+ResultCache::ResultCache(size_t capacity_bytes)
+  : shard_capacity_(capacity_bytes / kShards) {}
+
+// payload plus the list node and the hash map slot
+size_t ResultCache::EntryBytes(const Entry &entry) {
+  return entry.outputs.size() + sizeof(Entry) + 4 * sizeof(void*) + sizeof(uint64_t);
+}
+
+bool ResultCache::Lookup(uint64_t key, const std::vector<TfLiteTensor*> &outputs) {
+  Shard &shard = shards_[key % kShards];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(key);
+  if(it == shard.index.end()) {
+    shard.misses++;
+    return false;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  const char* data = it->second->outputs.data();
+  for(TfLiteTensor* tensor : outputs) {
+    memcpy(tensor->data.raw, data, tensor->bytes);
+    data += tensor->bytes;
+  }
+  shard.hits++;
+  return true;
+}
+
+void ResultCache::Insert(uint64_t key, const std::vector<TfLiteTensor*> &outputs) {
+  Entry entry;
+  entry.key = key;
+  size_t size = 0;
+  for(const TfLiteTensor* tensor : outputs) {
+    size += tensor->bytes;
+  }
+  entry.outputs.resize(size);
+  char* data = entry.outputs.data();
+  for(const TfLiteTensor* tensor : outputs) {
+    memcpy(data, tensor->data.raw, tensor->bytes);
+    data += tensor->bytes;
+  }
+  const size_t entry_bytes = EntryBytes(entry);
+  if(entry_bytes > shard_capacity_) {
+    return;
+  }
+
+  Shard &shard = shards_[key % kShards];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if(shard.index.count(key) != 0) {
+    // another instance of a pool got there first
+    return;
+  }
+  while(shard.bytes + entry_bytes > shard_capacity_) {
+    const Entry &oldest = shard.lru.back();
+    shard.bytes -= EntryBytes(oldest);
+    shard.index.erase(oldest.key);
+    shard.lru.pop_back();
+    shard.evictions++;
+  }
+  shard.lru.push_front(std::move(entry));
+  shard.index[key] = shard.lru.begin();
+  shard.bytes += entry_bytes;
+}
+
+void ResultCache::Stats(ResultCacheStats* stats) {
+  memset(stats, 0, sizeof(ResultCacheStats));
+  stats->capacity_bytes = shard_capacity_ * kShards;
+  for(Shard &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats->hits += shard.hits;
+    stats->misses += shard.misses;
+    stats->evictions += shard.evictions;
+    stats->entries += shard.lru.size();
+    stats->bytes += shard.bytes;
+  }
+}
@@ -0,0 +1,98 @@
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <algorithm>
+#include <cstring>
+
+#include "stage_stats.hpp"
+
+static const char* kStageNames[PREDICTOR_NUM_STAGES] = {
+  "preprocess", "quantize", "invoke", "dequantize", "topk",
+};
+
+LatencyHistogram::LatencyHistogram() {
+  Reset();
+}
+
+// Values below kSubBuckets get one bucket each. Above that, each power of two
+// [2^e, 2^(e+1)) is split into kSubBuckets equal buckets.
+int LatencyHistogram::BucketIndex(uint64_t ns) {
+  if(ns < (uint64_t)kSubBuckets) {
+    return ns;
+  }
+  const int msb = 63 - __builtin_clzll(ns);
+  const int shift = msb - kSubBucketBits;
+  return shift * kSubBuckets + (int)(ns >> shift);
+}
+
+uint64_t LatencyHistogram::BucketMidpoint(int index) {
+  if(index < 2 * kSubBuckets) {
+    return index;
+  }
+  const int shift = index / kSubBuckets - 1;
+  const uint64_t mantissa = index % kSubBuckets + kSubBuckets;
+  return (mantissa << shift) + ((uint64_t)1 << shift) / 2;
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+  ns = std::min<uint64_t>(ns, ((uint64_t)1 << kMaxBits) - 1);
+  buckets_[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  total_ns_.fetch_add(ns, std::memory_order_relaxed);
+  uint64_t max = max_ns_.load(std::memory_order_relaxed);
+  while(ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::Reset() {
+  count_.store(0, std::memory_order_relaxed);
+  total_ns_.store(0, std::memory_order_relaxed);
+  max_ns_.store(0, std::memory_order_relaxed);
+  for(int i = 0; i < kBuckets; i++) {
+    buckets_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+// Percentiles come from a snapshot of the buckets, so a concurrent Record may
+// or may not be included
+void LatencyHistogram::Summarize(StageStats* out) const {
+  uint64_t counts[kBuckets];
+  uint64_t count = 0;
+  for(int i = 0; i < kBuckets; i++) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    count += counts[i];
+  }
+  const double ns_per_ms = 1e6;
+  out->count = count;
+  out->total_ms = total_ns_.load(std::memory_order_relaxed) / ns_per_ms;
+  out->mean_ms = count > 0 ? out->total_ms / count : 0;
+  out->max_ms = max_ns_.load(std::memory_order_relaxed) / ns_per_ms;
+
+  const double quantiles[3] = {0.50, 0.90, 0.99};
+  double* targets[3] = {&out->p50_ms, &out->p90_ms, &out->p99_ms};
+  int q = 0;
+  uint64_t seen = 0;
+  for(int i = 0; i < kBuckets && q < 3 && count > 0; i++) {
+    seen += counts[i];
+    while(q < 3 && seen > quantiles[q] * count) {
+      *targets[q++] = std::min(BucketMidpoint(i) / ns_per_ms, out->max_ms);
+    }
+  }
+  for(; q < 3; q++) {
+    *targets[q] = 0;
+  }
+}
+
+void StageTimings::Reset() {
+  for(int i = 0; i < PREDICTOR_NUM_STAGES; i++) {
+    stages_[i].Reset();
+  }
+}
+
+int StageTimings::Export(StageStats* out, int max) const {
+  for(int i = 0; i < std::min(max, (int)PREDICTOR_NUM_STAGES); i++) {
+    memset(&out[i], 0, sizeof(StageStats));
+    out[i].stage = i;
+    strncpy(out[i].name, kStageNames[i], sizeof(out[i].name) - 1);
+    stages_[i].Summarize(&out[i]);
+  }
+  return PREDICTOR_NUM_STAGES;
+}
@@ -0,0 +1,159 @@
+#!/usr/bin/env python
+"""Write tiny.tflite, the model the Go benchmarks and the benchmark harness
+use when no other model is given.
+
+input  float32 [1, 8, 8, 3]
+fc     FULLY_CONNECTED 192 -> 10, fixed pseudo-random weights
+output SOFTMAX [1, 10]
+
+Only needs the flatbuffers package; the TFLite schema (version 3) is written
+by hand so that no TensorFlow install is required.
+"""
+
+import struct
+import sys
+
+import flatbuffers
+
+HEIGHT, WIDTH, CHANNELS, CLASSES = 8, 8, 3, 10
+FEATURES = HEIGHT * WIDTH * CHANNELS
+
+FLOAT32 = 0
+FULLY_CONNECTED = 9
+SOFTMAX = 25
+FULLY_CONNECTED_OPTIONS = 8
+SOFTMAX_OPTIONS = 9
+
+
+def weights():
+    # small deterministic LCG so the file is reproducible byte for byte
+    state, values = 1, []
+    for _ in range(CLASSES * FEATURES):
+        state = (state * 1103515245 + 12345) & 0x7FFFFFFF
+        values.append((state / float(0x7FFFFFFF) - 0.5) * 0.1)
+    return values
+
+
+def vector(builder, fmt, values, size, alignment=None):
+    builder.StartVector(size, len(values), alignment or size)
+    for value in reversed(values):
+        getattr(builder, fmt)(value)
+    return builder.EndVector()
+
+
+def ints(builder, values):
+    return vector(builder, "PrependInt32", values, 4)
+
+
+def offsets(builder, values):
+    return vector(builder, "PrependUOffsetTRelative", values, 4)
+
+
+def buffer(builder, data):
+    data_offset = None
+    if data:
+        builder.StartVector(1, len(data), 16)
+        for byte in reversed(bytearray(data)):
+            builder.PrependUint8(byte)
+        data_offset = builder.EndVector()
+    builder.StartObject(1)
+    if data_offset is not None:
+        builder.PrependUOffsetTRelativeSlot(0, data_offset, 0)
+    return builder.EndObject()
+
+
+def tensor(builder, name, shape, buffer_index):
+    name_offset = builder.CreateString(name)
+    shape_offset = ints(builder, shape)
+    builder.StartObject(5)
+    builder.PrependUOffsetTRelativeSlot(0, shape_offset, 0)
+    builder.PrependInt8Slot(1, FLOAT32, -1)
+    builder.PrependUint32Slot(2, buffer_index, 0xFFFFFFFF)
+    builder.PrependUOffsetTRelativeSlot(3, name_offset, 0)
+    return builder.EndObject()
+
+
+def operator(builder, opcode_index, inputs, outputs, options_type, options):
+    inputs_offset = ints(builder, inputs)
+    outputs_offset = ints(builder, outputs)
+    builder.StartObject(5)
+    builder.PrependUint32Slot(0, opcode_index, 0xFFFFFFFF)
+    builder.PrependUOffsetTRelativeSlot(1, inputs_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(2, outputs_offset, 0)
+    builder.PrependUint8Slot(3, options_type, 0xFF)
+    builder.PrependUOffsetTRelativeSlot(4, options, 0)
+    return builder.EndObject()
+
+
+def operator_code(builder, code):
+    # deprecated_builtin_code (byte) for old runtimes, builtin_code for new
+    builder.StartObject(4)
+    builder.PrependInt8Slot(0, code, -1)
+    builder.PrependInt32Slot(2, 1, 0)
+    builder.PrependInt32Slot(3, code, -1)
+    return builder.EndObject()
+
+
+def build():
+    builder = flatbuffers.Builder(1024)
+
+    buffers = [
+        buffer(builder, None),
+        buffer(builder, struct.pack("<%df" % (CLASSES * FEATURES), *weights())),
+        buffer(builder, struct.pack("<%df" % CLASSES, *([0.0] * CLASSES))),
+    ]
+
+    tensors = [
+        tensor(builder, "input", [1, HEIGHT, WIDTH, CHANNELS], 0),
+        tensor(builder, "fc/weights", [CLASSES, FEATURES], 1),
+        tensor(builder, "fc/bias", [CLASSES], 2),
+        tensor(builder, "fc", [1, CLASSES], 0),
+        tensor(builder, "output", [1, CLASSES], 0),
+    ]
+
+    builder.StartObject(4)  # FullyConnectedOptions, all defaults
+    fc_options = builder.EndObject()
+    builder.StartObject(1)  # SoftmaxOptions
+    builder.PrependFloat32Slot(0, 1.0, 0.0)
+    softmax_options = builder.EndObject()
+
+    operators = [
+        operator(builder, 0, [0, 1, 2], [3], FULLY_CONNECTED_OPTIONS, fc_options),
+        operator(builder, 1, [3], [4], SOFTMAX_OPTIONS, softmax_options),
+    ]
+
+    name = builder.CreateString("main")
+    tensors_offset = offsets(builder, tensors)
+    inputs_offset = ints(builder, [0])
+    outputs_offset = ints(builder, [4])
+    operators_offset = offsets(builder, operators)
+    builder.StartObject(5)
+    builder.PrependUOffsetTRelativeSlot(0, tensors_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(1, inputs_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(2, outputs_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(3, operators_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(4, name, 0)
+    subgraph = builder.EndObject()
+
+    codes = [operator_code(builder, FULLY_CONNECTED), operator_code(builder, SOFTMAX)]
+
+    description = builder.CreateString("tflite predictor test model")
+    codes_offset = offsets(builder, codes)
+    subgraphs_offset = offsets(builder, [subgraph])
+    buffers_offset = offsets(builder, buffers)
+    builder.StartObject(5)
+    builder.PrependUint32Slot(0, 3, 0)
+    builder.PrependUOffsetTRelativeSlot(1, codes_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(2, subgraphs_offset, 0)
+    builder.PrependUOffsetTRelativeSlot(3, description, 0)
+    builder.PrependUOffsetTRelativeSlot(4, buffers_offset, 0)
+    model = builder.EndObject()
+
+    builder.Finish(model, file_identifier=b"TFL3")
+    return builder.Output()
+
+
+if __name__ == "__main__":
+    path = sys.argv[1] if len(sys.argv) > 1 else "tiny.tflite"
+    with open(path, "wb") as f:
+        f.write(build())